@@ -1,11 +1,33 @@
 #include "adaptive_huffman.h"
+#include "../../archiver.h"
+#include "../../bitio.h"
 
-/* Not yet transmitted */
+/*
+ * Archive heading: the version in the high nibble of the first byte, then the signature.
+ * Codes of the bytes follow. A byte seen for the first time is sent as the NYT code
+ * and the byte itself in SYMBOL_BITS bits; the same escape with END_OF_DATA ends the archive.
+ * Version 2 models are updated with FGK, version 1 ones only swapped siblings
+ * (those archives can't be unarchived)
+ */
+#define ADAPTIVE_HUFFMAN_VERSION 2
+#define ADAPTIVE_HUFFMAN_VERSION_SHIFT 4
+#define SYMBOL_BITS 9
+#define END_OF_DATA UINT8_COUNT
+
+/* Not yet transmitted. Leaves of bytes hold byte + 1 */
 #define NYT 0
 
+/*
+ * Nodes are numbered so that weights never decrease with the number and siblings
+ * have adjacent numbers (the sibling property). The root has the highest number,
+ * each new symbol takes the next two lower ones
+ */
+#define ROOT_NUMBER ((UINT8_COUNT * 2) + 1)
+
 typedef struct TreeNode {
     uint16_t uniqueByte; /* Range: 0-256 */
     uint16_t number;
+    uint16_t block;      /* Index of the block of nodes with the same weight */
     uint64_t weight;
     bool hasValue;
 
@@ -14,8 +36,28 @@ typedef struct TreeNode {
     struct TreeNode* right;
 } TreeNode;
 
-static TreeNode* tree;
-static TreeNode* map[UINT8_COUNT + 1] = {NULL}; /* When encounters a new symbol, adds its pointer here */
+/*
+ * Nodes of the same weight have consecutive numbers; the highest-numbered
+ * one is the leader of the block
+ */
+typedef struct {
+    uint16_t leader;
+    uint16_t next;       /* Next free block */
+} WeightBlock;
+
+/*
+ * The whole model is one fixed-size struct: nodes are taken from the pool in order
+ * and never freed, so resetting the model doesn't allocate anything
+ */
+typedef struct {
+    TreeNode*   tree;
+    TreeNode*   map[UINT8_COUNT + 1];      /* When encounters a new symbol, adds its pointer here */
+    TreeNode*   nodes[ROOT_NUMBER + 1];    /* Nodes by number */
+    WeightBlock blocks[ROOT_NUMBER + 1];
+    uint16_t    freeBlock;                 /* First free block */
+    uint16_t    poolUsed;
+    TreeNode    pool[ROOT_NUMBER];
+} AdaptiveModel;
 
 static void set_node(TreeNode* node, uint16_t uniqueByte, uint16_t number, uint64_t weight,
                      bool hasValue, TreeNode* parent, TreeNode* left, TreeNode* right) {
@@ -31,134 +73,281 @@ static void set_node(TreeNode* node, uint16_t uniqueByte, uint16_t number, uint6
     node->right = right;
 }
 
-static void initialize_model() {
-    tree = malloc(sizeof(TreeNode));
-    set_node(tree, NYT, ((UINT8_COUNT * 2) + 1), 0, true, NULL, NULL, NULL);
-    map[NYT] = tree;
+static TreeNode* new_node(AdaptiveModel* model) {
+    return &model->pool[model->poolUsed++];
 }
 
-static void free_huffman_tree(TreeNode* tree) {
-    if (!tree) {
-        return;
-    }
-    if (!tree->left && !tree->right) { /* Tree leaf */
-        free(tree);
-        return;
+static uint16_t new_block(AdaptiveModel* model, uint16_t leader) {
+    uint16_t block = model->freeBlock;
+    model->freeBlock = model->blocks[block].next;
+    model->blocks[block].leader = leader;
+    return block;
+}
+
+static void free_block(AdaptiveModel* model, uint16_t block) {
+    model->blocks[block].next = model->freeBlock;
+    model->freeBlock = block;
+}
+
+static void initialize_model(AdaptiveModel* model) {
+    memset(model->map, 0, sizeof(model->map));
+    memset(model->nodes, 0, sizeof(model->nodes));
+    for (uint16_t i = 0; i <= ROOT_NUMBER; i++) {
+        model->blocks[i].next = i + 1;
     }
-    /* Otherwise, it's a parent node */
-    free_huffman_tree(tree->left);
-    free_huffman_tree(tree->right);
+    model->freeBlock = 0;
+    model->poolUsed = 0;
+
+    model->tree = new_node(model);
+    set_node(model->tree, NYT, ROOT_NUMBER, 0, true, NULL, NULL, NULL);
+    model->tree->block = new_block(model, ROOT_NUMBER);
+    model->nodes[ROOT_NUMBER] = model->tree;
+    model->map[NYT] = model->tree;
 }
 
-static void init_symbol(uint8_t c) {
-    TreeNode* nyt = malloc(sizeof(TreeNode));
-    TreeNode* external = malloc(sizeof(TreeNode));
-    TreeNode* oldNyt = map[NYT];
+/*
+ * Turns the NYT leaf into an internal node with a new NYT and the leaf of **c**
+ * as children. All three have weight 0, so they share the block of the old NYT
+ */
+static void init_symbol(AdaptiveModel* model, uint8_t c) {
+    TreeNode* nyt = new_node(model);
+    TreeNode* external = new_node(model);
+    TreeNode* oldNyt = model->map[NYT];
 
     set_node(nyt, NYT, (oldNyt->number - 2), 0, true, oldNyt, NULL, NULL);
-    set_node(external, c, (oldNyt->number - 1), 1, true, oldNyt, NULL, NULL);
+    set_node(external, c + 1, (oldNyt->number - 1), 0, true, oldNyt, NULL, NULL);
+    nyt->block = oldNyt->block;
+    external->block = oldNyt->block;
+    model->nodes[nyt->number] = nyt;
+    model->nodes[external->number] = external;
 
-    oldNyt->weight++;
     oldNyt->hasValue = false;
     oldNyt->left = nyt;
     oldNyt->right = external;
 
-    map[NYT] = nyt;
-    map[c+1] = external;
+    model->map[NYT] = nyt;
+    model->map[c+1] = external;
 }
 
-static void update_model(uint8_t c) {
-    TreeNode* current;
-    if (map[c+1] == NULL) {
-        current = map[NYT];
-        init_symbol(c);
-        if (current->parent == NULL) {
-            return;
+/*
+ * Swaps two nodes of the same weight together with their subtrees.
+ * They swap numbers too, so the numbers stay in place in the tree
+ */
+static void interchange(AdaptiveModel* model, TreeNode* a, TreeNode* b) {
+    TreeNode* parentA = a->parent;
+    TreeNode* parentB = b->parent;
+    if (parentA == parentB) {
+        TreeNode* left = parentA->left;
+        parentA->left = parentA->right;
+        parentA->right = left;
+    } else {
+        if (parentA->left == a) {
+            parentA->left = b;
+        } else {
+            parentA->right = b;
         }
-        current = current->parent;
+        if (parentB->left == b) {
+            parentB->left = a;
+        } else {
+            parentB->right = a;
+        }
+        a->parent = parentB;
+        b->parent = parentA;
+    }
+
+    uint16_t number = a->number;
+    a->number = b->number;
+    b->number = number;
+    model->nodes[a->number] = a;
+    model->nodes[b->number] = b;
+}
+
+/*
+ * Moves a node to the top of its block (unless the leader is its parent),
+ * then increments its weight, moving it to the next block
+ */
+static void slide_and_increment(AdaptiveModel* model, TreeNode* node) {
+    TreeNode* leader = model->nodes[model->blocks[node->block].leader];
+    if (leader != node && leader != node->parent) {
+        interchange(model, node, leader);
+    }
+
+    /* The node leaves its block from the top */
+    uint16_t number = node->number;
+    TreeNode* below = number > 0 ? model->nodes[number - 1] : NULL;
+    if (below != NULL && below->block == node->block) {
+        model->blocks[node->block].leader = number - 1;
+    } else {
+        free_block(model, node->block);
+    }
+
+    node->weight++;
+    TreeNode* above = number < ROOT_NUMBER ? model->nodes[number + 1] : NULL;
+    if (above != NULL && above->weight == node->weight) {
+        node->block = above->block;
     } else {
-        current = map[c+1];
-    }
-    while (current->parent != NULL) {
-        /* Node number max in block? */
-        if (current->number < current->parent->right->number &&
-            current->weight == current->parent->right->weight) {
-            /* Swapping */
-            current->parent->left = current->parent->right;
-            current->parent->right = current;
-            /* Preserve number */
-            uint16_t temp = current->parent->left->number;
-            current->parent->left->number = current->parent->right->number;
-            current->parent->right->number = temp;
+        node->block = new_block(model, number);
+    }
+}
+
+/*
+ * Algorithm FGK (as described by Vitter): the nodes on the path from the leaf of **c**
+ * to the root are moved to the top of their blocks and incremented, which keeps the
+ * sibling property. The leaf next to NYT is incremented last, after its parent
+ * has moved out of the block
+ */
+static void update_model(AdaptiveModel* model, uint8_t c) {
+    TreeNode* current = model->map[c+1];
+    TreeNode* leafToIncrement = NULL;
+    if (current == NULL) {
+        current = model->map[NYT];
+        init_symbol(model, c);
+        leafToIncrement = model->map[c+1];
+    } else {
+        TreeNode* leader = model->nodes[model->blocks[current->block].leader];
+        if (leader != current && leader != current->parent) {
+            interchange(model, current, leader);
+        }
+        if (current->parent == model->map[NYT]->parent) { /* Sibling of NYT */
+            leafToIncrement = current;
+            current = current->parent;
         }
-        current->weight++;
+    }
+    while (current != NULL) {
+        slide_and_increment(model, current);
         current = current->parent;
     }
-    current->weight++; /* Root node */
+    if (leafToIncrement != NULL) {
+        slide_and_increment(model, leafToIncrement);
+    }
 }
 
 /*
- * Takes an already existing byte, converts
- * it into a replace sequence
+ * Outputs the code of a symbol, going from its leaf up to the root. A bit taken
+ * on the way up becomes the highest bit of the Sequence, so the code comes out
+ * in root to leaf order. Codes get longer than a Sequence when the tree is
+ * unbalanced, so they're collected in parts
  */
-static Sequence replace_byte(uint8_t c, Sequence seq, TreeNode* tree) {
-    if (tree->hasValue) {
-        if (tree->uniqueByte == c) {
-            return seq;
+static void put_code(const AdaptiveModel* model, BitWriter* writer, uint16_t symbol) {
+    Sequence parts[UINT8_COUNT / 32 + 1]; /* Codes are at most 256 bits long */
+    size_t last = 0;
+    parts[0].value = 0;
+    parts[0].size = 0;
+    for (TreeNode* node = model->map[symbol]; node->parent != NULL; node = node->parent) {
+        if (parts[last].size == 32) {
+            last++;
+            parts[last].value = 0;
+            parts[last].size = 0;
         }
-        seq.value = 0;
-        seq.size = 0;
-        return seq;
-    }
-    seq.size++;
-    seq.value <<= 1;
-    Sequence furtherSeq = replace_byte(c, seq, tree->left);
-    if (furtherSeq.size != 0) {
-        return furtherSeq;
-    }
-    seq.value |= 1;
-    return replace_byte(c, seq, tree->right);
+        parts[last].value |= (uint32_t) (node == node->parent->right) << parts[last].size;
+        parts[last].size++;
+    }
+    for (size_t i = last + 1; i-- > 0;) {
+        bit_writer_put(writer, parts[i].value, parts[i].size);
+    }
 }
 
-static void encode(uint8_t c) {
-    if (map[c+1] != NULL) {
-        Sequence seq = {0, 0};
-        seq = replace_byte(c + 1, seq, tree);
-        output_bit_sequence(seq);
+/*
+ * Outputs the code of a byte, or the escape of a new byte (or END_OF_DATA)
+ */
+static void encode(AdaptiveModel* model, BitWriter* writer, uint16_t c) {
+    if (c != END_OF_DATA && model->map[c+1] != NULL) {
+        put_code(model, writer, c + 1);
         return;
     }
-    Sequence nyt = {0, 0};
-    nyt = replace_byte(NYT, nyt, tree);
-    output_bit_sequence(nyt);
-    Sequence code = {c, BYTE_SIZE};
-    output_bit_sequence(code);
+    put_code(model, writer, NYT);
+    bit_writer_put(writer, c, SYMBOL_BITS);
+}
+
+/*
+ * Encodes a block of bytes, updating the model after each one
+ */
+static void encode_bytes(AdaptiveModel* model, BitWriter* writer, const uint8_t* src, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        encode(model, writer, src[i]);
+        update_model(model, src[i]);
+    }
 }
 
 int adaptive_huffman_archive(Data* data) {
-    int c;
-    initialize_model();
-    while ((c = fgetc(fileIn)) != EOF) {
-        encode(c);
-        update_model(c);
+    uint8_t heading[] = {ADAPTIVE_HUFFMAN_VERSION << ADAPTIVE_HUFFMAN_VERSION_SHIFT, SIG_ADAPTIVE_HUFFMAN};
+    fwrite(heading, sizeof(uint8_t), sizeof(heading), fileOut);
+
+    AdaptiveModel model;
+    BitWriter writer;
+    initialize_model(&model);
+    bit_writer_init(&writer, fileOut);
+    if (mappedIn.data != NULL) {
+        encode_bytes(&model, &writer, mappedIn.data, mappedIn.size);
+    } else {
+        size_t size;
+        while ((size = update_buffer()) > 0) {
+            encode_bytes(&model, &writer, bufferIn, size);
+        }
     }
-    flush_incomplete_bytes();
-    free_huffman_tree(tree);
+    encode(&model, &writer, END_OF_DATA);
+    bit_writer_finish(&writer);
+    bit_writer_free(&writer);
     return 0;
 }
 
-static int8_t decode() {
-    static Sequence byte;
-    return 0;
+/*
+ * Walks the tree from the root by the input bits. Returns the byte, END_OF_DATA,
+ * or FAILURE if the escape holds an invalid symbol
+ */
+static int decode(const AdaptiveModel* model, BitReader* reader) {
+    TreeNode* node = model->tree;
+    while (!node->hasValue) {
+        /* Up to 56 levels are walked with the bits of one window */
+        uint64_t bits = bit_reader_peek(reader, 56) << 8;
+        uint8_t used = 0;
+        while (!node->hasValue && used < 56) {
+            node = bits >> 63 ? node->right : node->left;
+            bits <<= 1;
+            used++;
+        }
+        bit_reader_consume(reader, used);
+    }
+    if (node->uniqueByte != NYT) {
+        return node->uniqueByte - 1;
+    }
+    uint16_t c = bit_reader_read(reader, SYMBOL_BITS);
+    if (c == END_OF_DATA) {
+        return c;
+    }
+    return c < END_OF_DATA && model->map[c+1] == NULL ? c : FAILURE;
 }
 
 int adaptive_huffman_unarchive(Data* data) {
+    uint8_t heading[2] = {0};
+    fread(heading, sizeof(uint8_t), sizeof(heading), fileIn);
+    if (heading[0] >> ADAPTIVE_HUFFMAN_VERSION_SHIFT != ADAPTIVE_HUFFMAN_VERSION ||
+        heading[1] != SIG_ADAPTIVE_HUFFMAN) {
+        archiveError("invalid archive");
+        return FAILURE;
+    }
+
+    BitReader reader;
+    if (mappedIn.data != NULL) {
+        bit_reader_init_memory(&reader, mappedIn.data + sizeof(heading), mappedIn.size - sizeof(heading));
+    } else {
+        bit_reader_init(&reader, fileIn);
+    }
+
     int c;
-    initialize_model();
-    while((c = decode()) != EOF) {
+    int success = 0;
+    AdaptiveModel model;
+    initialize_model(&model);
+    while ((c = decode(&model, &reader)) != END_OF_DATA) {
+        if (c == FAILURE || bit_reader_overrun(&reader)) {
+            archiveError(c == FAILURE ? "invalid archive" : "unexpected end of archive");
+            success = FAILURE;
+            break;
+        }
         output_byte(c);
-        update_model(c);
+        update_model(&model, c);
     }
-    flush_incomplete_bytes();
-    free_huffman_tree(tree);
-    return 0;
+    flush_buffer();
+    bit_reader_free(&reader);
+    return success;
 }
\ No newline at end of file
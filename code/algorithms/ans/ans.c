@@ -0,0 +1,430 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ans.h"
+#include "../huffman/heading.h"
+#include "../../bitio.h"
+
+/*
+ * Table-based asymmetric numeral systems (tANS). A state in [ANS_TABLE_SIZE, 2 * ANS_TABLE_SIZE)
+ * holds a fraction of a bit; a symbol of normalized frequency f takes about
+ * ANS_TABLE_LOG - log2(f) bits, so skewed bytes cost less than a whole bit.
+ *
+ * Archived block: 1 byte - ANS_BLOCK_STORED, followed by the block bytes as they are,
+ * ANS_BLOCK_SINGLE, followed by the only byte of the block,
+ * or ANS_BLOCK_CODED, followed by bits:
+ * 8 bits  - the largest byte of the block
+ * Normalized frequencies of bytes 0 to the largest one, each one in as many bits as the
+ *   rest of ANS_TABLE_SIZE takes (nothing once it's 0). Then zero bits up to a whole byte
+ * Zero bits and a 1 bit, ending in a whole byte
+ * ANS_TABLE_LOG bits - ANS_STATES initial states of the decoder (minus ANS_TABLE_SIZE)
+ * Bits of the states after each byte, in the order of block bytes. Byte i is
+ *   decoded by state i % ANS_STATES, so the states are independent and are
+ *   decoded in parallel by the CPU
+ */
+#define ANS_BLOCK_STORED 0
+#define ANS_BLOCK_SINGLE 1
+#define ANS_BLOCK_CODED  2
+
+/* The decoder reads bits for ANS_STATES bytes after one refill, which fit 56 bits */
+#define ANS_TABLE_LOG  12
+#define ANS_TABLE_SIZE (1u << ANS_TABLE_LOG)
+#define ANS_STATES     4
+
+/* Coding of a byte */
+typedef struct {
+    int32_t  findState; /* Offset of its states in the state table */
+    uint32_t deltaBits; /* Number of bits to write is (state + deltaBits) >> 16 */
+} AnsSymbol;
+
+typedef struct {
+    uint16_t nextState; /* Added to the bits read after the byte */
+    uint8_t  symbol;
+    uint8_t  bits;
+} AnsDecodeEntry;
+
+/*
+ * Encoder output. Bytes are encoded from the last one, while the decoder reads bits
+ * from the first one, so bits are put in front of the ones already written, and the
+ * buffer is filled from its end
+ */
+typedef struct {
+    uint64_t accumulator; /* Pending bits, the last one put is the most significant one */
+    uint8_t  count;       /* Number of pending bits, less than 32 between calls */
+    uint8_t* start;       /* The written bytes start here */
+} ReverseWriter;
+
+static int encode_block(const uint8_t* src, size_t size, BitWriter* writer, const Data* data, BlockStats* stats);
+static int decode_block(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize, const Data* data);
+static size_t bound_block(size_t size);
+
+const BlockCodec ansBlockCodec = {SIG_ANS, encode_block, decode_block, bound_block};
+
+static inline uint8_t high_bit(uint32_t value) {
+    return 31 - __builtin_clz(value);
+}
+
+/*
+ * Returns the number of bits a frequency takes when **remaining** of the table is left
+ */
+static inline uint8_t frequency_bits(uint32_t remaining) {
+    return remaining != 0 ? high_bit(remaining) + 1 : 0;
+}
+
+/*
+ * Scales byte weights to frequencies which sum to ANS_TABLE_SIZE. Every byte which
+ * occurs gets at least 1; the rounding error is taken from (or given to) the most
+ * frequent bytes, as it costs them the least
+ */
+static void normalize(const long* weights, size_t total, uint16_t* frequencies) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < UINT8_COUNT; i++) {
+        if (weights[i] == 0) {
+            frequencies[i] = 0;
+            continue;
+        }
+        uint64_t scaled = ((uint64_t) weights[i] * ANS_TABLE_SIZE + total / 2) / total;
+        frequencies[i] = scaled != 0 ? scaled : 1;
+        sum += frequencies[i];
+    }
+    while (sum != ANS_TABLE_SIZE) {
+        size_t largest = 0;
+        for (size_t i = 1; i < UINT8_COUNT; i++) {
+            if (frequencies[i] > frequencies[largest]) {
+                largest = i;
+            }
+        }
+        if (sum > ANS_TABLE_SIZE) {
+            frequencies[largest]--;
+            sum--;
+        } else {
+            frequencies[largest]++;
+            sum++;
+        }
+    }
+}
+
+/*
+ * Spreads bytes over the table, each one taking as many entries as its frequency.
+ * The step is odd, so it visits every entry, and it scatters the entries of a byte
+ */
+static void spread_symbols(const uint16_t* frequencies, uint8_t* spread) {
+    uint32_t step = (ANS_TABLE_SIZE >> 1) + (ANS_TABLE_SIZE >> 3) + 3;
+    uint32_t position = 0;
+    for (size_t i = 0; i < UINT8_COUNT; i++) {
+        for (uint32_t j = 0; j < frequencies[i]; j++) {
+            spread[position] = i;
+            position = (position + step) & (ANS_TABLE_SIZE - 1);
+        }
+    }
+}
+
+static void build_encode_table(const uint16_t* frequencies, uint16_t* stateTable, AnsSymbol* symbols) {
+    uint8_t spread[ANS_TABLE_SIZE];
+    spread_symbols(frequencies, spread);
+
+    uint32_t next[UINT8_COUNT];
+    uint32_t total = 0;
+    for (size_t i = 0; i < UINT8_COUNT; i++) {
+        next[i] = total;
+        symbols[i].findState = (int32_t) total - frequencies[i];
+        if (frequencies[i] == 1) {
+            symbols[i].deltaBits = (ANS_TABLE_LOG << 16) - ANS_TABLE_SIZE;
+        } else if (frequencies[i] > 1) {
+            uint32_t maxBits = ANS_TABLE_LOG - high_bit(frequencies[i] - 1);
+            symbols[i].deltaBits = (maxBits << 16) - (frequencies[i] << maxBits);
+        }
+        total += frequencies[i];
+    }
+    for (uint32_t i = 0; i < ANS_TABLE_SIZE; i++) {
+        stateTable[next[spread[i]]++] = ANS_TABLE_SIZE + i;
+    }
+}
+
+static void build_decode_table(const uint16_t* frequencies, AnsDecodeEntry* table) {
+    uint8_t spread[ANS_TABLE_SIZE];
+    spread_symbols(frequencies, spread);
+
+    uint32_t next[UINT8_COUNT];
+    for (size_t i = 0; i < UINT8_COUNT; i++) {
+        next[i] = frequencies[i];
+    }
+    for (uint32_t i = 0; i < ANS_TABLE_SIZE; i++) {
+        uint8_t symbol = spread[i];
+        uint32_t state = next[symbol]++;
+        uint8_t bits = ANS_TABLE_LOG - high_bit(state);
+        AnsDecodeEntry entry = {(state << bits) - ANS_TABLE_SIZE, symbol, bits};
+        table[i] = entry;
+    }
+}
+
+/*
+ * Puts **size** low bits of **value** in front of the written ones. Pending bits
+ * aren't written, so at most 64 of them can be put before reverse_flush()
+ */
+static inline void reverse_put(ReverseWriter* writer, uint32_t value, uint8_t size) {
+    writer->accumulator |= (uint64_t) value << writer->count;
+    writer->count += size;
+}
+
+/*
+ * Writes whole 32-bit words of pending bits
+ */
+static inline void reverse_flush(ReverseWriter* writer) {
+    if (writer->count >= 32) {
+        uint32_t word = __builtin_bswap32((uint32_t) writer->accumulator);
+        writer->start -= sizeof(word);
+        memcpy(writer->start, &word, sizeof(word));
+        writer->accumulator >>= 32;
+        writer->count -= 32;
+    }
+}
+
+/*
+ * Puts a 1 bit in front of the written ones and writes the pending bits,
+ * padding them with zero bits to a whole byte
+ */
+static void reverse_finish(ReverseWriter* writer) {
+    reverse_put(writer, 1, 1);
+    reverse_flush(writer);
+    while (writer->count > 0) {
+        *--writer->start = writer->accumulator & 0xff;
+        writer->accumulator >>= BYTE_SIZE;
+        writer->count = writer->count > BYTE_SIZE ? writer->count - BYTE_SIZE : 0;
+    }
+}
+
+static inline void encode_symbol(ReverseWriter* writer, uint32_t* state, const AnsSymbol* symbol,
+                                 const uint16_t* stateTable) {
+    uint32_t bits = (*state + symbol->deltaBits) >> 16;
+    reverse_put(writer, *state & ((1u << bits) - 1), bits);
+    *state = stateTable[(*state >> bits) + symbol->findState];
+}
+
+/*
+ * Returns about how many bits the bytes take with the normalized frequencies,
+ * in 1/256 bits. The fraction of log2 is taken as linear between powers of two
+ */
+static uint64_t estimate_bits(const long* weights, const uint16_t* frequencies) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < UINT8_COUNT; i++) {
+        if (weights[i] != 0) {
+            uint8_t highBit = high_bit(frequencies[i]);
+            uint32_t log = (highBit << BYTE_SIZE) + ((frequencies[i] << BYTE_SIZE) >> highBit) - (1 << BYTE_SIZE);
+            bits += (uint64_t) weights[i] * ((ANS_TABLE_LOG << BYTE_SIZE) - log);
+        }
+    }
+    return bits >> BYTE_SIZE;
+}
+
+static void store_block(const uint8_t* src, size_t size, BitWriter* writer) {
+    bit_writer_put(writer, ANS_BLOCK_STORED, BYTE_SIZE);
+    bit_writer_put_bytes(writer, src, size);
+}
+
+/*
+ * Archives a block: counts its bytes, normalizes their weights to frequencies, and
+ * codes the bytes with ANS_STATES interleaved states. Blocks which don't get smaller are stored
+ */
+static int encode_block(const uint8_t* src, size_t size, BitWriter* writer, const Data* data, BlockStats* stats) {
+    stats->payloadBits = 0;
+    stats->unlimitedPayloadBits = 0;
+
+    long weights[UINT8_COUNT] = {0};
+    count_bytes_weight(src, size, weights);
+    size_t largest = 0, symbolsCount = 0;
+    for (size_t i = 0; i < UINT8_COUNT; i++) {
+        if (weights[i] != 0) {
+            largest = i;
+            symbolsCount++;
+        }
+    }
+    if (symbolsCount == 1) {
+        bit_writer_put(writer, ANS_BLOCK_SINGLE, BYTE_SIZE);
+        bit_writer_put(writer, src[0], BYTE_SIZE);
+        bit_writer_finish(writer);
+        return 0;
+    }
+    uint16_t frequencies[UINT8_COUNT] = {0};
+    if (size != 0) {
+        normalize(weights, size, frequencies);
+    }
+    if (size == 0 || estimate_bits(weights, frequencies) >= (uint64_t) size * BYTE_SIZE) {
+        store_block(src, size, writer);
+        return 0;
+    }
+
+    bit_writer_put(writer, ANS_BLOCK_CODED, BYTE_SIZE);
+    bit_writer_put(writer, largest, BYTE_SIZE);
+    uint32_t remaining = ANS_TABLE_SIZE;
+    for (size_t i = 0; i <= largest; i++) {
+        bit_writer_put(writer, frequencies[i], frequency_bits(remaining));
+        remaining -= frequencies[i];
+    }
+    bit_writer_finish(writer);
+    size_t headerSize = writer->size;
+
+    uint16_t stateTable[ANS_TABLE_SIZE];
+    AnsSymbol symbols[UINT8_COUNT];
+    build_encode_table(frequencies, stateTable, symbols);
+
+    /* A byte takes at most ANS_TABLE_LOG bits */
+    size_t streamBound = (size * ANS_TABLE_LOG + ANS_STATES * ANS_TABLE_LOG) / BYTE_SIZE + 2 * sizeof(uint32_t);
+    uint8_t* stream = bit_writer_reserve(writer, streamBound);
+    ReverseWriter reverse = {0, 0, stream + streamBound};
+    uint32_t states[ANS_STATES];
+    for (size_t i = 0; i < ANS_STATES; i++) {
+        states[i] = ANS_TABLE_SIZE;
+    }
+    size_t i = size;
+    for (; i % ANS_STATES != 0; i--) {
+        encode_symbol(&reverse, &states[(i - 1) % ANS_STATES], &symbols[src[i - 1]], stateTable);
+        reverse_flush(&reverse);
+    }
+    /* Bits of two bytes fit the pending bits at once */
+    uint32_t state0 = states[0], state1 = states[1], state2 = states[2], state3 = states[3];
+    for (; i > 0; i -= ANS_STATES) {
+        encode_symbol(&reverse, &state3, &symbols[src[i - 1]], stateTable);
+        encode_symbol(&reverse, &state2, &symbols[src[i - 2]], stateTable);
+        reverse_flush(&reverse);
+        encode_symbol(&reverse, &state1, &symbols[src[i - 3]], stateTable);
+        encode_symbol(&reverse, &state0, &symbols[src[i - 4]], stateTable);
+        reverse_flush(&reverse);
+    }
+    states[0] = state0;
+    states[1] = state1;
+    states[2] = state2;
+    states[3] = state3;
+    for (size_t j = ANS_STATES; j > 0; j--) {
+        reverse_put(&reverse, states[j - 1] - ANS_TABLE_SIZE, ANS_TABLE_LOG);
+        reverse_flush(&reverse);
+    }
+    reverse_finish(&reverse);
+
+    size_t streamSize = stream + streamBound - reverse.start;
+    if (headerSize + streamSize > 1 + size) {
+        bit_writer_reset(writer);
+        store_block(src, size, writer);
+        return 0;
+    }
+    memmove(stream, reverse.start, streamSize);
+    writer->size += streamSize;
+    return 0;
+}
+
+/*
+ * Blocks which would grow are stored
+ */
+static size_t bound_block(size_t size) {
+    return 1 + size;
+}
+
+/*
+ * Reads the frequencies of a coded block. Returns the number of bits they took,
+ * or FAILURE if they don't sum to ANS_TABLE_SIZE
+ */
+static long read_frequencies(BitReader* reader, uint16_t* frequencies) {
+    size_t largest = bit_reader_read(reader, BYTE_SIZE);
+    long bits = BYTE_SIZE;
+    uint32_t remaining = ANS_TABLE_SIZE;
+    for (size_t i = 0; i < UINT8_COUNT; i++) {
+        frequencies[i] = 0;
+        if (i > largest || remaining == 0) {
+            continue;
+        }
+        uint8_t size = frequency_bits(remaining);
+        frequencies[i] = bit_reader_read(reader, size);
+        bits += size;
+        if (frequencies[i] > remaining) {
+            return FAILURE;
+        }
+        remaining -= frequencies[i];
+    }
+    return remaining == 0 ? bits : FAILURE;
+}
+
+/*
+ * Decodes a byte and moves the state on. The bits are taken from the window without
+ * a check, so the reader has to be refilled for every ANS_STATES bytes
+ */
+static inline uint8_t decode_symbol(const AnsDecodeEntry* table, uint32_t* state, BitReader* reader) {
+    AnsDecodeEntry entry = table[*state];
+    /* Shifted twice, as shifting by 64 for 0 bits is undefined */
+    *state = entry.nextState + (uint32_t) ((reader->window >> 1) >> (63 - entry.bits));
+    bit_reader_consume(reader, entry.bits);
+    return entry.symbol;
+}
+
+/*
+ * Unarchives a block written by encode_block()
+ */
+static int decode_block(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize, const Data* data) {
+    if (srcSize < 1) {
+        return FAILURE;
+    }
+    if (src[0] == ANS_BLOCK_STORED) {
+        if (srcSize - 1 != dstSize) {
+            return FAILURE;
+        }
+        memcpy(dst, src + 1, dstSize);
+        return 0;
+    }
+    if (src[0] == ANS_BLOCK_SINGLE) {
+        if (srcSize != 2) {
+            return FAILURE;
+        }
+        memset(dst, src[1], dstSize);
+        return 0;
+    }
+    if (src[0] != ANS_BLOCK_CODED) {
+        return FAILURE;
+    }
+
+    BitReader reader;
+    bit_reader_init_memory(&reader, src + 1, srcSize - 1);
+    uint16_t frequencies[UINT8_COUNT];
+    long headerBits = read_frequencies(&reader, frequencies);
+    if (headerBits == FAILURE) {
+        return FAILURE;
+    }
+    if (headerBits % BYTE_SIZE != 0) {
+        bit_reader_consume(&reader, BYTE_SIZE - headerBits % BYTE_SIZE);
+    }
+    uint8_t first = bit_reader_peek(&reader, BYTE_SIZE);
+    if (first == 0) {
+        return FAILURE;
+    }
+    bit_reader_consume(&reader, BYTE_SIZE - high_bit(first));
+
+    AnsDecodeEntry table[ANS_TABLE_SIZE];
+    build_decode_table(frequencies, table);
+    uint32_t states[ANS_STATES];
+    for (size_t i = 0; i < ANS_STATES; i++) {
+        states[i] = bit_reader_read(&reader, ANS_TABLE_LOG);
+    }
+
+    uint32_t state0 = states[0], state1 = states[1], state2 = states[2], state3 = states[3];
+    size_t i = 0;
+    for (; i + ANS_STATES <= dstSize; i += ANS_STATES) {
+        bit_reader_refill(&reader);
+        dst[i]     = decode_symbol(table, &state0, &reader);
+        dst[i + 1] = decode_symbol(table, &state1, &reader);
+        dst[i + 2] = decode_symbol(table, &state2, &reader);
+        dst[i + 3] = decode_symbol(table, &state3, &reader);
+    }
+    states[0] = state0;
+    states[1] = state1;
+    states[2] = state2;
+    states[3] = state3;
+    for (; i < dstSize; i++) {
+        bit_reader_refill(&reader);
+        dst[i] = decode_symbol(table, &states[i % ANS_STATES], &reader);
+    }
+    /* The encoder started from ANS_TABLE_SIZE in every state */
+    for (size_t j = 0; j < ANS_STATES; j++) {
+        if (states[j] != 0) {
+            return FAILURE;
+        }
+    }
+    return bit_reader_overrun(&reader) ? FAILURE : 0;
+}
@@ -0,0 +1,12 @@
+#ifndef ANS_H
+#define ANS_H
+
+#include <stdio.h>
+
+#include "../../common.h"
+#include "../../data.h"
+#include "../../blocks.h"
+
+extern const BlockCodec ansBlockCodec;
+
+#endif
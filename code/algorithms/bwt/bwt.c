@@ -0,0 +1,324 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bwt.h"
+#include "suffix_array.h"
+#include "../huffman/block_codes.h"
+#include "../../archiver.h"
+#include "../../bitio.h"
+
+/*
+ * Archived block: 1 byte - BWT_BLOCK_STORED, followed by the block bytes as they are,
+ * or BWT_BLOCK_CODED, followed by bits:
+ * 24 bits - primary index, the row of the whole block among the sorted suffixes
+ * For each of BWT_TABLES code tables:
+ *   9 bits - number of code lengths (the lengths of the rest of the codes are 0)
+ *   4 bits - each code length
+ * Codes of the symbols, until the block is complete. Each symbol is coded
+ * with the table chosen by the class of the symbol before it
+ *
+ * The block is transformed in four steps:
+ * - Burrows-Wheeler transform: the byte before each suffix, in the order of the suffixes.
+ *   The block ends with a virtual sentinel, which is smaller than any byte; it's left out,
+ *   and the primary index tells where it was
+ * - Move-to-front: each byte becomes its rank among the bytes ordered by their last use.
+ *   Runs of equal bytes turn into runs of zero ranks
+ * - Zero runs: a run of zero ranks is its length in bijective base 2, with the digits
+ *   BWT_RUN_A (1) and BWT_RUN_B (2), least significant first. Other ranks are shifted
+ *   up by one, after the two digits
+ * - Huffman codes
+ */
+#define BWT_BLOCK_STORED 0
+#define BWT_BLOCK_CODED  1
+
+#define BWT_RUN_A   0
+#define BWT_RUN_B   1
+#define BWT_SYMBOLS (UINT8_COUNT + 1)
+
+#define BWT_TABLES 4
+#define BWT_PRIMARY_BITS 24
+#define BWT_COUNT_BITS   9
+
+/*
+ * Symbols after a zero run, after rank 1, after ranks 2-3 and after larger ranks
+ * have quite different odds, so each of these classes has its own table
+ */
+static uint8_t symbol_class(uint16_t symbol) {
+    if (symbol <= BWT_RUN_B) {
+        return 0;
+    }
+    return symbol == BWT_RUN_B + 1 ? 1 : symbol <= BWT_RUN_B + 3 ? 2 : 3;
+}
+
+static int encode_block(const uint8_t* src, size_t size, BitWriter* writer, const Data* data, BlockStats* stats);
+static int decode_block(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize, const Data* data);
+static size_t bound_block(size_t size);
+
+const BlockCodec bwtBlockCodec = {SIG_BWT, encode_block, decode_block, bound_block};
+
+/*
+ * Writes the last column of the sorted rotations of src (with the sentinel) to dst,
+ * without the sentinel. Returns the primary index
+ */
+static uint32_t transform(const uint8_t* src, size_t size, uint8_t* dst) {
+    int32_t* suffixArray = malloc(size * sizeof(int32_t));
+    build_suffix_array(src, suffixArray, size);
+
+    /* The sentinel's own suffix is the first one, it comes after the last byte */
+    uint32_t primary = 0;
+    size_t j = 0;
+    dst[j++] = src[size - 1];
+    for (size_t i = 0; i < size; i++) {
+        if (suffixArray[i] == 0) {
+            primary = i + 1;
+        } else {
+            dst[j++] = src[suffixArray[i] - 1];
+        }
+    }
+    free(suffixArray);
+    return primary;
+}
+
+static void put_zero_run(uint16_t* symbols, size_t* count, size_t run) {
+    while (run > 0) {
+        run--;
+        symbols[(*count)++] = run & 1 ? BWT_RUN_B : BWT_RUN_A;
+        run >>= 1;
+    }
+}
+
+/*
+ * Replaces bytes with their move-to-front ranks and codes zero runs.
+ * Returns the number of symbols, which is at most **size**
+ */
+static size_t move_to_front(const uint8_t* bytes, size_t size, uint16_t* symbols) {
+    uint8_t order[UINT8_COUNT];
+    for (uint16_t i = 0; i < UINT8_COUNT; i++) {
+        order[i] = i;
+    }
+    size_t count = 0;
+    size_t run = 0;
+    for (size_t i = 0; i < size; i++) {
+        uint8_t byte = bytes[i];
+        if (order[0] == byte) {
+            run++;
+            continue;
+        }
+        put_zero_run(symbols, &count, run);
+        run = 0;
+
+        uint16_t rank = 1;
+        while (order[rank] != byte) {
+            rank++;
+        }
+        memmove(order + 1, order, rank);
+        order[0] = byte;
+        symbols[count++] = BWT_RUN_B + rank;
+    }
+    put_zero_run(symbols, &count, run);
+    return count;
+}
+
+/*
+ * Archives a block: transforms it and Huffman codes the symbols.
+ * Blocks which don't get smaller are stored
+ */
+static int encode_block(const uint8_t* src, size_t size, BitWriter* writer, const Data* data, BlockStats* stats) {
+    stats->payloadBits = 0;
+    stats->unlimitedPayloadBits = 0;
+    if (size > BWT_MAX_BLOCK_SIZE) {
+        return FAILURE;
+    }
+
+    uint8_t* lastColumn = malloc(size);
+    uint32_t primary = transform(src, size, lastColumn);
+    uint16_t* symbols = malloc(size * sizeof(uint16_t));
+    size_t count = move_to_front(lastColumn, size, symbols);
+    free(lastColumn);
+
+    long weights[BWT_TABLES][BWT_SYMBOLS] = {{0}};
+    uint8_t previousClass = 0;
+    for (size_t i = 0; i < count; i++) {
+        weights[previousClass][symbols[i]]++;
+        previousClass = symbol_class(symbols[i]);
+    }
+
+    uint8_t lengths[BWT_TABLES][BWT_SYMBOLS];
+    size_t lengthsCount[BWT_TABLES];
+    uint64_t bits = BWT_PRIMARY_BITS;
+    for (uint8_t table = 0; table < BWT_TABLES; table++) {
+        build_block_code_lengths(weights[table], BWT_SYMBOLS, lengths[table]);
+        lengthsCount[table] = used_block_codes(lengths[table], BWT_SYMBOLS);
+        bits += BWT_COUNT_BITS + lengthsCount[table] * BLOCK_CODE_LENGTH_BITS;
+        for (size_t i = 0; i < BWT_SYMBOLS; i++) {
+            bits += (uint64_t) weights[table][i] * lengths[table][i];
+        }
+    }
+    if ((bits + BYTE_SIZE - 1) / BYTE_SIZE >= size) {
+        bit_writer_put(writer, BWT_BLOCK_STORED, BYTE_SIZE);
+        bit_writer_put_bytes(writer, src, size);
+        free(symbols);
+        return 0;
+    }
+
+    Sequence codes[BWT_TABLES][BWT_SYMBOLS];
+    bit_writer_put(writer, BWT_BLOCK_CODED, BYTE_SIZE);
+    bit_writer_put(writer, primary, BWT_PRIMARY_BITS);
+    for (uint8_t table = 0; table < BWT_TABLES; table++) {
+        build_block_codes(lengths[table], BWT_SYMBOLS, codes[table]);
+        bit_writer_put(writer, lengthsCount[table], BWT_COUNT_BITS);
+        for (size_t i = 0; i < lengthsCount[table]; i++) {
+            bit_writer_put(writer, lengths[table][i], BLOCK_CODE_LENGTH_BITS);
+        }
+    }
+
+    previousClass = 0;
+    for (size_t i = 0; i < count; i++) {
+        Sequence seq = codes[previousClass][symbols[i]];
+        bit_writer_put(writer, seq.value, seq.size);
+        previousClass = symbol_class(symbols[i]);
+    }
+    bit_writer_finish(writer);
+    free(symbols);
+    return 0;
+}
+
+/*
+ * Blocks which would grow are stored
+ */
+static size_t bound_block(size_t size) {
+    return 1 + size;
+}
+
+/*
+ * Undoes the Huffman codes, zero runs and move-to-front, writing the last column
+ * of the transform to dst. Returns FAILURE if the symbols don't give **dstSize** bytes
+ */
+static int decode_last_column(BitReader* reader, const BlockDecodeEntry tables[][BLOCK_DECODE_TABLE_SIZE],
+                              uint8_t* dst, size_t dstSize) {
+    uint8_t order[UINT8_COUNT];
+    for (uint16_t i = 0; i < UINT8_COUNT; i++) {
+        order[i] = i;
+    }
+    size_t position = 0;
+    size_t run = 0;
+    size_t runDigit = 1;
+    uint8_t previousClass = 0;
+    while (position + run < dstSize) {
+        BlockDecodeEntry entry = tables[previousClass][bit_reader_peek(reader, BLOCK_CODE_MAX_LENGTH)];
+        if (entry.length == 0) {
+            return FAILURE;
+        }
+        bit_reader_consume(reader, entry.length);
+        previousClass = symbol_class(entry.symbol);
+        if (entry.symbol <= BWT_RUN_B) {
+            run += runDigit << entry.symbol;
+            runDigit <<= 1;
+            if (run > dstSize - position) {
+                return FAILURE;
+            }
+            continue;
+        }
+        memset(dst + position, order[0], run);
+        position += run;
+        run = 0;
+        runDigit = 1;
+
+        uint16_t rank = entry.symbol - BWT_RUN_B;
+        uint8_t byte = order[rank];
+        memmove(order + 1, order, rank);
+        order[0] = byte;
+        dst[position++] = byte;
+    }
+    memset(dst + position, order[0], run);
+    return 0;
+}
+
+/*
+ * Inverse transform. Each row of the sorted rotations gets the first byte of its rotation
+ * and the row of the rotation one byte further (in the high bits), then the rows are
+ * walked from the primary one. Rows fit into 24 bits, as blocks are at most 8M
+ */
+static void inverse_transform(uint8_t* bytes, size_t size, uint32_t primary) {
+    uint32_t* rows = malloc((size + 1) * sizeof(uint32_t));
+    uint32_t starts[UINT8_COUNT];
+    uint32_t counts[UINT8_COUNT] = {0};
+    for (size_t i = 0; i < size; i++) {
+        counts[bytes[i]]++;
+    }
+    uint32_t sum = 1; /* The row of the sentinel comes first */
+    for (uint16_t c = 0; c < UINT8_COUNT; c++) {
+        starts[c] = sum;
+        sum += counts[c];
+    }
+
+    /* The sentinel is at the primary row of the last column, the other bytes are shifted by it */
+    rows[0] = primary << BYTE_SIZE;
+    for (size_t row = 0; row <= size; row++) {
+        if (row == primary) {
+            continue;
+        }
+        uint8_t byte = bytes[row < primary ? row : row - 1];
+        rows[starts[byte]++] = (uint32_t) row << BYTE_SIZE | byte;
+    }
+
+    uint32_t row = primary;
+    for (size_t i = 0; i < size; i++) {
+        uint32_t entry = rows[row];
+        bytes[i] = entry;
+        row = entry >> BYTE_SIZE;
+    }
+    free(rows);
+}
+
+/*
+ * Unarchives a block written by encode_block()
+ */
+static int decode_block(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize, const Data* data) {
+    if (srcSize < 1) {
+        return FAILURE;
+    }
+    if (src[0] == BWT_BLOCK_STORED) {
+        if (srcSize - 1 != dstSize) {
+            return FAILURE;
+        }
+        memcpy(dst, src + 1, dstSize);
+        return 0;
+    }
+    if (src[0] != BWT_BLOCK_CODED || dstSize > BWT_MAX_BLOCK_SIZE) {
+        return FAILURE;
+    }
+
+    BitReader reader;
+    bit_reader_init_memory(&reader, src + 1, srcSize - 1);
+    uint32_t primary = bit_reader_read(&reader, BWT_PRIMARY_BITS);
+    if (primary == 0 || primary > dstSize) {
+        return FAILURE;
+    }
+    BlockDecodeEntry tables[BWT_TABLES][BLOCK_DECODE_TABLE_SIZE];
+    for (uint8_t table = 0; table < BWT_TABLES; table++) {
+        size_t count = bit_reader_read(&reader, BWT_COUNT_BITS);
+        if (count > BWT_SYMBOLS || read_block_decode_table(&reader, count, BWT_SYMBOLS, tables[table]) == FAILURE) {
+            return FAILURE;
+        }
+    }
+    if (decode_last_column(&reader, tables, dst, dstSize) == FAILURE || bit_reader_overrun(&reader)) {
+        return FAILURE;
+    }
+    inverse_transform(dst, dstSize, primary);
+    return 0;
+}
+
+/*
+ * BWT archives are always block archives, with blocks of at most BWT_MAX_BLOCK_SIZE bytes
+ */
+int bwt_archive(Data* data) {
+    if (data->blockSize == 0) {
+        data->blockSize = BWT_MAX_BLOCK_SIZE;
+    }
+    if (data->blockSize > BWT_MAX_BLOCK_SIZE) {
+        archiveError("bwt blocks can't be larger than %dM", BWT_MAX_BLOCK_SIZE >> 20);
+        return FAILURE;
+    }
+    return blocks_codec_archive(data, &bwtBlockCodec);
+}
@@ -0,0 +1,16 @@
+#ifndef BWT_H
+#define BWT_H
+
+#include <stdio.h>
+
+#include "../../common.h"
+#include "../../data.h"
+#include "../../blocks.h"
+
+#define BWT_MAX_BLOCK_SIZE (8 << 20)
+
+extern const BlockCodec bwtBlockCodec;
+
+int bwt_archive(Data* data);
+
+#endif
@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "suffix_array.h"
+
+/*
+ * SA-IS (Nong, Zhang and Chan): suffixes are L-type if they're larger than the next
+ * suffix and S-type otherwise. An S-type suffix after an L-type one is a leftmost
+ * S-type (LMS) suffix. Once the LMS suffixes are sorted, the rest of the suffix array
+ * is induced from them with two scans. To sort them, the LMS substrings (from one LMS
+ * position to the next) are sorted by the same inducing, named by their order,
+ * and the string of names is sorted recursively.
+ *
+ * The text ends with a virtual sentinel, smaller than any symbol. It's an LMS suffix
+ * which is never stored: it's always the first in the suffix array and induces the last
+ * suffix of the text. Symbols of the top level are bytes, of the recursive levels int32_t
+ */
+#define EMPTY -1
+
+typedef struct {
+    const void* text;
+    int32_t     size;
+    int32_t     alphabetSize;
+    bool        isBytes;
+    uint8_t*    types;     /* Bit set for S-type suffixes */
+    int32_t*    buckets;
+} Level;
+
+static inline int32_t symbol(const Level* level, int32_t i) {
+    return level->isBytes ? ((const uint8_t*) level->text)[i] : ((const int32_t*) level->text)[i];
+}
+
+static inline bool is_s_type(const Level* level, int32_t i) {
+    return (level->types[i >> 3] >> (i & 7)) & 1;
+}
+
+static inline bool is_lms(const Level* level, int32_t i) {
+    return i > 0 && is_s_type(level, i) && !is_s_type(level, i - 1);
+}
+
+static void find_types(Level* level) {
+    int32_t n = level->size;
+    memset(level->types, 0, ((size_t) n + 7) / 8);
+    /* The last suffix is larger than the sentinel, so it's L-type */
+    bool sType = false;
+    for (int32_t i = n - 2; i >= 0; i--) {
+        int32_t current = symbol(level, i);
+        int32_t next = symbol(level, i + 1);
+        sType = current < next || (current == next && sType);
+        if (sType) {
+            level->types[i >> 3] |= 1 << (i & 7);
+        }
+    }
+}
+
+/*
+ * Sets buckets to the first (or one past the last) positions of each symbol's bucket
+ */
+static void find_buckets(Level* level, bool ends) {
+    int32_t* buckets = level->buckets;
+    memset(buckets, 0, level->alphabetSize * sizeof(int32_t));
+    for (int32_t i = 0; i < level->size; i++) {
+        buckets[symbol(level, i)]++;
+    }
+    int32_t sum = 0;
+    for (int32_t c = 0; c < level->alphabetSize; c++) {
+        sum += buckets[c];
+        buckets[c] = ends ? sum : sum - buckets[c];
+    }
+}
+
+/*
+ * Places L-type suffixes after the ones in the suffix array, then S-type suffixes
+ * before them. The LMS suffixes must be at the ends of their buckets
+ */
+static void induce(Level* level, int32_t* suffixArray) {
+    int32_t n = level->size;
+    find_buckets(level, false);
+    /* The sentinel comes first and induces the last suffix */
+    suffixArray[level->buckets[symbol(level, n - 1)]++] = n - 1;
+    for (int32_t i = 0; i < n; i++) {
+        int32_t j = suffixArray[i] - 1;
+        if (j >= 0 && !is_s_type(level, j)) {
+            suffixArray[level->buckets[symbol(level, j)]++] = j;
+        }
+    }
+    find_buckets(level, true);
+    for (int32_t i = n - 1; i >= 0; i--) {
+        int32_t j = suffixArray[i] - 1;
+        if (j >= 0 && is_s_type(level, j)) {
+            suffixArray[--level->buckets[symbol(level, j)]] = j;
+        }
+    }
+}
+
+/*
+ * Returns true if the LMS substrings at **a** and **b** are equal: the same symbols
+ * and types up to the next LMS position, which must be the same in both
+ */
+static bool equal_lms_substrings(const Level* level, int32_t a, int32_t b) {
+    int32_t n = level->size;
+    for (int32_t d = 0;; d++) {
+        /* Substrings ending at the sentinel are unique */
+        if (a + d == n || b + d == n ||
+            symbol(level, a + d) != symbol(level, b + d) ||
+            is_s_type(level, a + d) != is_s_type(level, b + d)) {
+            return false;
+        }
+        if (d > 0 && (is_lms(level, a + d) || is_lms(level, b + d))) {
+            return is_lms(level, a + d) && is_lms(level, b + d);
+        }
+    }
+}
+
+static void sort_suffixes(const void* text, int32_t* suffixArray, int32_t n, int32_t alphabetSize, bool isBytes) {
+    Level level = {text, n, alphabetSize, isBytes, malloc(((size_t) n + 7) / 8),
+                   malloc(alphabetSize * sizeof(int32_t))};
+    find_types(&level);
+
+    /* Sorts the LMS substrings */
+    for (int32_t i = 0; i < n; i++) {
+        suffixArray[i] = EMPTY;
+    }
+    find_buckets(&level, true);
+    for (int32_t i = n - 1; i > 0; i--) {
+        if (is_lms(&level, i)) {
+            suffixArray[--level.buckets[symbol(&level, i)]] = i;
+        }
+    }
+    induce(&level, suffixArray);
+
+    /* Moves them to the front, then names them. There are at most n / 2 of them,
+     * and they're at least 2 apart, so the names fit after them by position / 2 */
+    int32_t lmsCount = 0;
+    for (int32_t i = 0; i < n; i++) {
+        if (is_lms(&level, suffixArray[i])) {
+            suffixArray[lmsCount++] = suffixArray[i];
+        }
+    }
+    for (int32_t i = lmsCount; i < n; i++) {
+        suffixArray[i] = EMPTY;
+    }
+    int32_t names = 0;
+    int32_t previous = EMPTY;
+    for (int32_t i = 0; i < lmsCount; i++) {
+        int32_t position = suffixArray[i];
+        if (previous == EMPTY || !equal_lms_substrings(&level, previous, position)) {
+            names++;
+        }
+        previous = position;
+        suffixArray[lmsCount + position / 2] = names - 1;
+    }
+    /* The string of names, in text order, goes to the end of the array */
+    for (int32_t i = n - 1, j = n - 1; i >= lmsCount; i--) {
+        if (suffixArray[i] != EMPTY) {
+            suffixArray[j--] = suffixArray[i];
+        }
+    }
+
+    /* Sorts the LMS suffixes by their string of names */
+    int32_t* reduced = suffixArray + n - lmsCount;
+    if (names < lmsCount) {
+        sort_suffixes(reduced, suffixArray, lmsCount, names, false);
+    } else {
+        for (int32_t i = 0; i < lmsCount; i++) {
+            suffixArray[reduced[i]] = i;
+        }
+    }
+    for (int32_t i = 1, j = 0; i < n; i++) {
+        if (is_lms(&level, i)) {
+            reduced[j++] = i;
+        }
+    }
+    for (int32_t i = 0; i < lmsCount; i++) {
+        suffixArray[i] = reduced[suffixArray[i]];
+    }
+
+    /* Induces the suffix array from the sorted LMS suffixes, at the ends of their buckets */
+    for (int32_t i = lmsCount; i < n; i++) {
+        suffixArray[i] = EMPTY;
+    }
+    find_buckets(&level, true);
+    for (int32_t i = lmsCount - 1; i >= 0; i--) {
+        int32_t position = suffixArray[i];
+        suffixArray[i] = EMPTY;
+        suffixArray[--level.buckets[symbol(&level, position)]] = position;
+    }
+    induce(&level, suffixArray);
+
+    free(level.types);
+    free(level.buckets);
+}
+
+void build_suffix_array(const uint8_t* text, int32_t* suffixArray, int32_t size) {
+    if (size == 1) {
+        suffixArray[0] = 0;
+    } else if (size > 1) {
+        sort_suffixes(text, suffixArray, size, UINT8_COUNT, true);
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef BWT_SUFFIX_ARRAY_H
+#define BWT_SUFFIX_ARRAY_H
+
+#include "../../common.h"
+
+/*
+ * Fills suffixArray with the start positions of the **size** suffixes of text
+ * in sorted order, in linear time. A suffix which is a prefix of another one
+ * is the smaller one
+ */
+void build_suffix_array(const uint8_t* text, int32_t* suffixArray, int32_t size);
+
+#endif
@@ -0,0 +1,330 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fast.h"
+#include "../../bitio.h"
+
+/*
+ * Archived block: 1 byte - FAST_BLOCK_STORED, followed by the block bytes as they are,
+ * or FAST_BLOCK_CODED, followed by sequences of whole bytes:
+ * 1 byte  - token: number of literals in the high nibble, match length minus
+ *           FAST_MIN_MATCH in the low one. A nibble of FAST_NIBBLE_MAX goes on in
+ *           the following bytes (after the literals for the match length), each
+ *           adding 0-255, up to the first one which isn't 255
+ * X bytes - literals
+ * 2 bytes - match distance, little-endian
+ * The last sequence has only literals (maybe none), and ends with the block
+ */
+#define FAST_BLOCK_STORED 0
+#define FAST_BLOCK_CODED  1
+
+#define FAST_MIN_MATCH    4
+#define FAST_MAX_DISTANCE UINT16_MAX
+#define FAST_NIBBLE_MAX   15
+
+/* The hash table has a single position per hash, so it's small enough for the L1/L2 cache */
+#define FAST_HASH_BITS 14
+
+/* After 2^FAST_SKIP_SHIFT positions without a match, the search skips more bytes per step */
+#define FAST_SKIP_SHIFT 6
+
+/* The decoder copies this many bytes at once where the buffers have room for it */
+#define FAST_WILD_COPY 16
+
+static int encode_block(const uint8_t* src, size_t size, BitWriter* writer, const Data* data, BlockStats* stats);
+static int decode_block(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize, const Data* data);
+static size_t bound_block(size_t size);
+
+const BlockCodec fastBlockCodec = {SIG_FAST, encode_block, decode_block, bound_block};
+
+static inline uint32_t read32(const uint8_t* bytes) {
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+static inline uint32_t hash(uint32_t word, uint8_t hashBits) {
+    return (word * 2654435761u) >> (32 - hashBits);
+}
+
+/*
+ * Returns the number of equal bytes at a and b, up to **limit**
+ */
+static inline size_t common_length(const uint8_t* a, const uint8_t* b, size_t limit) {
+    size_t length = 0;
+    while (length + sizeof(uint64_t) <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a + length, sizeof(x));
+        memcpy(&y, b + length, sizeof(y));
+        if (x != y) {
+            return length + (__builtin_ctzll(x ^ y) >> 3);
+        }
+        length += sizeof(uint64_t);
+    }
+    while (length < limit && a[length] == b[length]) {
+        length++;
+    }
+    return length;
+}
+
+/*
+ * Writes the part of a length which doesn't fit into a token nibble
+ */
+static inline uint8_t* put_length(uint8_t* out, size_t length) {
+    for (; length >= UINT8_MAX; length -= UINT8_MAX) {
+        *out++ = UINT8_MAX;
+    }
+    *out++ = length;
+    return out;
+}
+
+/*
+ * Writes **literalCount** literals and a match (none if **matchLength** is 0)
+ */
+static inline uint8_t* put_sequence(uint8_t* out, const uint8_t* literals, size_t literalCount,
+                                    size_t matchLength, size_t distance) {
+    size_t matchCode = matchLength != 0 ? matchLength - FAST_MIN_MATCH : 0;
+    uint8_t* token = out++;
+    *token = (literalCount < FAST_NIBBLE_MAX ? literalCount : FAST_NIBBLE_MAX) << 4 |
+             (matchCode < FAST_NIBBLE_MAX ? matchCode : FAST_NIBBLE_MAX);
+    if (literalCount >= FAST_NIBBLE_MAX) {
+        out = put_length(out, literalCount - FAST_NIBBLE_MAX);
+    }
+    memcpy(out, literals, literalCount);
+    out += literalCount;
+    if (matchLength == 0) {
+        return out;
+    }
+    out[0] = distance & 0xff;
+    out[1] = distance >> BYTE_SIZE;
+    out += 2;
+    if (matchCode >= FAST_NIBBLE_MAX) {
+        out = put_length(out, matchCode - FAST_NIBBLE_MAX);
+    }
+    return out;
+}
+
+/*
+ * The most a block can take before it's known whether it has to be stored:
+ * all literals, with a length byte per 255 of them
+ */
+static size_t coded_bound(size_t size) {
+    return 2 + size + size / UINT8_MAX + 1;
+}
+
+/*
+ * Archives a block: each position is looked up in a hash table of the last position
+ * with the same first bytes, and a match is taken as soon as one is found.
+ * There is no entropy coding. Blocks which don't get smaller are stored
+ */
+static int encode_block(const uint8_t* src, size_t size, BitWriter* writer, const Data* data, BlockStats* stats) {
+    stats->payloadBits = 0;
+    stats->unlimitedPayloadBits = 0;
+
+    uint8_t* start = bit_writer_reserve(writer, coded_bound(size));
+    uint8_t* out = start;
+    *out++ = FAST_BLOCK_CODED;
+
+    uint8_t hashBits = FAST_HASH_BITS;
+    while (hashBits > BYTE_SIZE && ((size_t) 1 << (hashBits - 1)) >= size) {
+        hashBits--;
+    }
+    uint32_t table[1 << FAST_HASH_BITS];
+    memset(table, 0, ((size_t) 1 << hashBits) * sizeof(uint32_t));
+
+    size_t anchor = 0;   /* Start of the literals not written yet */
+    size_t position = 0;
+    size_t misses = 0;
+    while (position + FAST_MIN_MATCH <= size) {
+        uint32_t word = read32(src + position);
+        uint32_t h = hash(word, hashBits);
+        size_t candidate = table[h];
+        table[h] = position;
+        /* Entries are earlier positions (0 at first), so a zero distance wraps around */
+        if (position - candidate - 1 >= FAST_MAX_DISTANCE || read32(src + candidate) != word) {
+            position += 1 + (misses++ >> FAST_SKIP_SHIFT);
+            continue;
+        }
+        misses = 0;
+        while (position > anchor && candidate > 0 && src[position - 1] == src[candidate - 1]) {
+            position--;
+            candidate--;
+        }
+        size_t length = FAST_MIN_MATCH + common_length(src + position + FAST_MIN_MATCH,
+                                                       src + candidate + FAST_MIN_MATCH,
+                                                       size - position - FAST_MIN_MATCH);
+        out = put_sequence(out, src + anchor, position - anchor, length, position - candidate);
+        position += length;
+        anchor = position;
+        /* Positions inside the match aren't hashed, except one near its end */
+        if (position + FAST_MIN_MATCH <= size + 2) {
+            table[hash(read32(src + position - 2), hashBits)] = position - 2;
+        }
+    }
+    out = put_sequence(out, src + anchor, size - anchor, 0, 0);
+
+    if ((size_t) (out - start) > 1 + size) {
+        start[0] = FAST_BLOCK_STORED;
+        memcpy(start + 1, src, size);
+        out = start + 1 + size;
+    }
+    writer->size += out - start;
+    return 0;
+}
+
+/*
+ * Blocks which would grow are stored
+ */
+static size_t bound_block(size_t size) {
+    return 1 + size;
+}
+
+/*
+ * Adds the rest of a length after its token nibble. Returns FAILURE if the block ends first
+ */
+static inline int add_length(const uint8_t** in, const uint8_t* end, size_t* length) {
+    uint8_t byte;
+    do {
+        if (*in == end) {
+            return FAILURE;
+        }
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == UINT8_MAX);
+    return 0;
+}
+
+/*
+ * Copies FAST_WILD_COPY bytes at a time, so up to FAST_WILD_COPY - 1 bytes
+ * after **size** are written (and read) too
+ */
+static inline void wild_copy(uint8_t* dst, const uint8_t* src, size_t size) {
+    uint8_t* end = dst + size;
+    do {
+        memcpy(dst, src, FAST_WILD_COPY);
+        dst += FAST_WILD_COPY;
+        src += FAST_WILD_COPY;
+    } while (dst < end);
+}
+
+/*
+ * Copies a match by words, although it may overlap its own source: a distance
+ * shorter than a word is first widened to its multiple of at least a word, which
+ * repeats the same bytes. Up to FAST_WILD_COPY - 1 bytes after the match are written too
+ */
+static inline void copy_match_words(uint8_t* dst, const uint8_t* src, size_t distance, size_t length) {
+    if (distance >= FAST_WILD_COPY) {
+        wild_copy(dst, src, length);
+        return;
+    }
+    uint8_t* end = dst + length;
+    if (distance < sizeof(uint64_t)) {
+        size_t period = distance * ((sizeof(uint64_t) + distance - 1) / distance);
+        for (size_t i = 0; i < period; i++) {
+            dst[i] = src[i];
+        }
+        src = dst;
+        dst += period;
+    }
+    while (dst < end) {
+        memcpy(dst, src, sizeof(uint64_t));
+        dst += sizeof(uint64_t);
+        src += sizeof(uint64_t);
+    }
+}
+
+/*
+ * Copies a match. Its bytes in the last FAST_WILD_COPY bytes of the block are copied one by one
+ */
+static inline void copy_match(uint8_t* dst, size_t distance, size_t length, const uint8_t* dstEnd) {
+    const uint8_t* src = dst - distance;
+    size_t room = dstEnd - dst;
+    size_t byWords = room > FAST_WILD_COPY ? room - FAST_WILD_COPY : 0;
+    if (length <= byWords) {
+        copy_match_words(dst, src, distance, length);
+        return;
+    }
+    if (byWords > 0) {
+        copy_match_words(dst, src, distance, byWords);
+        dst += byWords;
+        src += byWords;
+        length -= byWords;
+    }
+    while (length-- > 0) {
+        *dst++ = *src++;
+    }
+}
+
+/*
+ * Unarchives a block written by encode_block()
+ */
+static int decode_block(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize, const Data* data) {
+    if (srcSize < 1) {
+        return FAILURE;
+    }
+    if (src[0] == FAST_BLOCK_STORED) {
+        if (srcSize - 1 != dstSize) {
+            return FAILURE;
+        }
+        memcpy(dst, src + 1, dstSize);
+        return 0;
+    }
+    if (src[0] != FAST_BLOCK_CODED) {
+        return FAILURE;
+    }
+
+    const uint8_t* in = src + 1;
+    const uint8_t* inEnd = src + srcSize;
+    uint8_t* out = dst;
+    const uint8_t* outEnd = dst + dstSize;
+    while (true) {
+        if (in == inEnd) {
+            return FAILURE;
+        }
+        uint8_t token = *in++;
+        size_t literalCount = token >> 4;
+        size_t inLeft = inEnd - in;
+        size_t outLeft = outEnd - out;
+        if (literalCount < FAST_NIBBLE_MAX && inLeft >= 2 * FAST_WILD_COPY && outLeft >= 2 * FAST_WILD_COPY) {
+            /* Most sequences have few literals, and a match follows them, as the block goes on */
+            memcpy(out, in, FAST_WILD_COPY);
+            in += literalCount;
+            out += literalCount;
+        } else {
+            if (literalCount == FAST_NIBBLE_MAX && add_length(&in, inEnd, &literalCount) == FAILURE) {
+                return FAILURE;
+            }
+            inLeft = inEnd - in;
+            if (literalCount > inLeft || literalCount > outLeft) {
+                return FAILURE;
+            }
+            if (literalCount + FAST_WILD_COPY <= inLeft && literalCount + FAST_WILD_COPY <= outLeft) {
+                wild_copy(out, in, literalCount);
+            } else {
+                memcpy(out, in, literalCount);
+            }
+            in += literalCount;
+            out += literalCount;
+            if (out == outEnd) {
+                break;
+            }
+            if (inEnd - in < 2) {
+                return FAILURE;
+            }
+        }
+
+        size_t distance = in[0] | (size_t) in[1] << BYTE_SIZE;
+        in += 2;
+        size_t length = token & FAST_NIBBLE_MAX;
+        if (length == FAST_NIBBLE_MAX && add_length(&in, inEnd, &length) == FAILURE) {
+            return FAILURE;
+        }
+        length += FAST_MIN_MATCH;
+        if (distance == 0 || distance > (size_t) (out - dst) || length > (size_t) (outEnd - out)) {
+            return FAILURE;
+        }
+        copy_match(out, distance, length, outEnd);
+        out += length;
+    }
+    return in == inEnd ? 0 : FAILURE;
+}
@@ -0,0 +1,12 @@
+#ifndef FAST_H
+#define FAST_H
+
+#include <stdio.h>
+
+#include "../../common.h"
+#include "../../data.h"
+#include "../../blocks.h"
+
+extern const BlockCodec fastBlockCodec;
+
+#endif
@@ -0,0 +1,89 @@
+#include <string.h>
+
+#include "block_codes.h"
+#include "heading.h"
+
+/*
+ * Finds code lengths of **count** symbols by their weights, limited to BLOCK_CODE_MAX_LENGTH bits
+ */
+void build_block_code_lengths(const long* weights, size_t count, uint8_t* lengths) {
+    size_t symbols = 0, lastSymbol = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (weights[i] != 0) {
+            symbols++;
+            lastSymbol = i;
+        }
+    }
+    memset(lengths, 0, count);
+    if (symbols == 1) {
+        lengths[lastSymbol] = 1;
+    } else if (symbols > 1) {
+        limit_code_lengths(weights, count, lengths, BLOCK_CODE_MAX_LENGTH);
+    }
+}
+
+/*
+ * Assigns canonical codes (see heading.h) to **count** symbols by their code lengths
+ */
+void build_block_codes(const uint8_t* lengths, size_t count, Sequence* codes) {
+    uint16_t lengthsCount[BLOCK_CODE_MAX_LENGTH + 1] = {0};
+    for (size_t i = 0; i < count; i++) {
+        lengthsCount[lengths[i]]++;
+    }
+    lengthsCount[0] = 0;
+
+    uint32_t next[BLOCK_CODE_MAX_LENGTH + 1];
+    uint32_t code = 0;
+    for (uint8_t length = 1; length <= BLOCK_CODE_MAX_LENGTH; length++) {
+        code = (code + lengthsCount[length - 1]) << 1;
+        next[length] = code;
+    }
+    for (size_t i = 0; i < count; i++) {
+        Sequence seq = {lengths[i] != 0 ? next[lengths[i]]++ : 0, lengths[i]};
+        codes[i] = seq;
+    }
+}
+
+/*
+ * Returns the number of code lengths to send: the ones after the last used code are 0
+ */
+size_t used_block_codes(const uint8_t* lengths, size_t count) {
+    while (count > 0 && lengths[count - 1] == 0) {
+        count--;
+    }
+    return count;
+}
+
+/*
+ * Reads **count** code lengths and fills a table indexed by the next BLOCK_CODE_MAX_LENGTH
+ * bits of the stream. Returns FAILURE if the lengths don't describe a prefix code
+ */
+int read_block_decode_table(BitReader* reader, size_t count, size_t alphabetSize, BlockDecodeEntry* table) {
+    uint8_t lengths[BLOCK_CODE_MAX_SYMBOLS] = {0};
+    uint32_t space = 0;
+    for (size_t i = 0; i < count; i++) {
+        lengths[i] = bit_reader_read(reader, BLOCK_CODE_LENGTH_BITS);
+        if (lengths[i] > BLOCK_CODE_MAX_LENGTH) {
+            return FAILURE;
+        }
+        space += lengths[i] != 0 ? 1u << (BLOCK_CODE_MAX_LENGTH - lengths[i]) : 0;
+    }
+    if (space > (1u << BLOCK_CODE_MAX_LENGTH)) {
+        return FAILURE;
+    }
+
+    Sequence codes[BLOCK_CODE_MAX_SYMBOLS];
+    build_block_codes(lengths, alphabetSize, codes);
+    memset(table, 0, BLOCK_DECODE_TABLE_SIZE * sizeof(BlockDecodeEntry));
+    for (size_t i = 0; i < count; i++) {
+        if (lengths[i] == 0) {
+            continue;
+        }
+        uint8_t freeBits = BLOCK_CODE_MAX_LENGTH - lengths[i];
+        BlockDecodeEntry entry = {i, lengths[i]};
+        for (uint32_t j = 0; j < (1u << freeBits); j++) {
+            table[(codes[i].value << freeBits) | j] = entry;
+        }
+    }
+    return 0;
+}
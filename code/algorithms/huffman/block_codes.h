@@ -0,0 +1,27 @@
+#ifndef HUFFMAN_BLOCK_CODES_H
+#define HUFFMAN_BLOCK_CODES_H
+
+#include "../../common.h"
+#include "../../bitio.h"
+
+/*
+ * Canonical Huffman codes of the lz and bwt blocks. Code lengths are limited to
+ * BLOCK_CODE_MAX_LENGTH bits, so a code is decoded with a single table lookup,
+ * and they're sent as BLOCK_CODE_LENGTH_BITS-bit numbers
+ */
+#define BLOCK_CODE_MAX_LENGTH  12
+#define BLOCK_CODE_LENGTH_BITS 4
+#define BLOCK_CODE_MAX_SYMBOLS 288 /* Largest alphabet */
+#define BLOCK_DECODE_TABLE_SIZE (1 << BLOCK_CODE_MAX_LENGTH)
+
+typedef struct {
+    uint16_t symbol;
+    uint8_t  length;   /* 0 for bits which don't start a code */
+} BlockDecodeEntry;
+
+void build_block_code_lengths(const long* weights, size_t count, uint8_t* lengths);
+void build_block_codes(const uint8_t* lengths, size_t count, Sequence* codes);
+size_t used_block_codes(const uint8_t* lengths, size_t count);
+int read_block_decode_table(BitReader* reader, size_t count, size_t alphabetSize, BlockDecodeEntry* table);
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+
+#include "decode_table.h"
+
+/*
+ * Returns the length of the longest path from node to a leaf
+ */
+static uint8_t tree_height(HuffmanTreeNode* node) {
+    if (node->hasValue) {
+        return 0;
+    }
+    uint8_t left = tree_height(node->left);
+    uint8_t right = tree_height(node->right);
+    return (left > right ? left : right) + 1;
+}
+
+/*
+ * Reserves a new table of 2^bits slots and returns its index
+ */
+static uint16_t reserve_table(DecodeTables* decodeTables, uint8_t bits) {
+    size_t index = decodeTables->tablesCount++;
+    decodeTables->tables = realloc(decodeTables->tables, decodeTables->tablesCount * sizeof(DecodeTable));
+    decodeTables->tables[index].bits = bits;
+    decodeTables->tables[index].offset = decodeTables->entriesCount;
+
+    decodeTables->entriesCount += (size_t) 1 << bits;
+    decodeTables->entries = realloc(decodeTables->entries, decodeTables->entriesCount * sizeof(DecodeEntry));
+    return index;
+}
+
+/*
+ * Fills a table for the subtree rooted at **node**. Every slot index is a bit
+ * combination: it is walked down the tree until either a leaf is reached or
+ * all index bits are used, in which case a next-level table is built for the
+ * node we stopped at
+ */
+static uint16_t fill_table(DecodeTables* decodeTables, HuffmanTreeNode* node, uint8_t maxBits) {
+    uint8_t height = tree_height(node);
+    uint8_t bits = height < maxBits ? height : maxBits;
+    uint16_t index = reserve_table(decodeTables, bits);
+    size_t offset = decodeTables->tables[index].offset;
+
+    for (size_t i = 0; i < ((size_t) 1 << bits); i++) {
+        HuffmanTreeNode* current = node;
+        uint8_t depth = 0;
+        while (!current->hasValue && depth < bits) {
+            uint8_t bit = (i >> (bits - 1 - depth)) & 1;
+            current = bit == 0 ? current->left : current->right;
+            depth++;
+        }
+        DecodeEntry entry = {0, depth, 0};
+        if (current->hasValue) {
+            entry.symbol = current->uniqueByte;
+        } else {
+            /* Tables may be reallocated here, so the slot is written afterwards */
+            entry.next = fill_table(decodeTables, current, DECODE_SUB_BITS);
+        }
+        decodeTables->entries[offset + i] = entry;
+    }
+    return index;
+}
+
+void build_decode_tables(HuffmanTreeNode* tree, DecodeTables* decodeTables) {
+    decodeTables->tables = NULL;
+    decodeTables->tablesCount = 0;
+    decodeTables->entries = NULL;
+    decodeTables->entriesCount = 0;
+    fill_table(decodeTables, tree, DECODE_ROOT_BITS);
+
+#ifdef DEBUG
+    fprintf(stderr, "Decode tables: %ld tables, %ld entries\n\n", decodeTables->tablesCount,
+                                                         decodeTables->entriesCount);
+#endif
+}
+
+void free_decode_tables(DecodeTables* decodeTables) {
+    free(decodeTables->tables);
+    free(decodeTables->entries);
+    decodeTables->tables = NULL;
+    decodeTables->entries = NULL;
+    decodeTables->tablesCount = 0;
+    decodeTables->entriesCount = 0;
+}
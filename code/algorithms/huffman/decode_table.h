@@ -0,0 +1,42 @@
+#ifndef HUFFMAN_DECODE_TABLE_H
+#define HUFFMAN_DECODE_TABLE_H
+
+#include "heading.h"
+
+#define DECODE_ROOT_BITS 11 /* Bits resolved by a single probe of the first-level table */
+#define DECODE_SUB_BITS  8  /* Max bits resolved by a probe of a next-level table */
+
+/**
+ * One slot of a lookup table. A slot either resolves a complete codeword
+ * (next == 0): **symbol** is the decoded byte and **length** is the number of
+ * bits the codeword occupies; or it links to a next-level table for longer
+ * codewords (next != 0): all **length** index bits are consumed and decoding
+ * continues in tables[next]
+ */
+typedef struct {
+    uint8_t  symbol;
+    uint8_t  length;
+    uint16_t next;
+} DecodeEntry;
+
+typedef struct {
+    uint8_t bits;     /* Number of bits used to index the table */
+    size_t  offset;   /* Index of the first table slot in **entries** */
+} DecodeTable;
+
+/**
+ * Multi-level lookup tables, built from a Huffman tree.
+ * tables[0] is the first-level table, indexed by the next DECODE_ROOT_BITS bits
+ * of the stream (fewer, if the tree is shallower)
+ */
+typedef struct {
+    DecodeTable* tables;
+    size_t       tablesCount;
+    DecodeEntry* entries;
+    size_t       entriesCount;
+} DecodeTables;
+
+void build_decode_tables(HuffmanTreeNode* tree, DecodeTables* decodeTables);
+void free_decode_tables(DecodeTables* decodeTables);
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <time.h>
 
@@ -6,13 +7,18 @@
 #include "huffman.h"
 #include "../../utils/priority_queue.h"
 
+#define HISTOGRAM_TABLES 4
+#define HISTOGRAM_CHUNK_SIZE ((size_t) 1 << 30)
+
 void init_huffman_heading(HuffmanHeading* heading) {
+    heading->version = HUFFMAN_VERSION;
     heading->ignoreBits = 0;
     heading->signature = SIG_HUFFMAN;
-    heading->treeShapeSize = 0;
-    heading->treeLeavesSize = 0;
-    heading->treeShape = makelist();
-    heading->treeLeaves = makelist();
+    heading->symbolsCount = 0;
+    heading->maxLength = 0;
+    heading->originalSize = 0;
+    memset(heading->lengthsCount, 0, sizeof(heading->lengthsCount));
+    memset(heading->symbols, 0, sizeof(heading->symbols));
 }
 
 /**
@@ -21,17 +27,46 @@ void init_huffman_heading(HuffmanHeading* heading) {
  * represents a single unique byte; the value of each element
  * is weight (0 - file doesn't contain this byte)
  */
-static void find_bytes_weight(FILE* fileIn, long* weights) {
+void find_bytes_weight(FILE* fileIn, long* weights) {
     while (true) {
         int bytesRead = fread(bufferIn, sizeof(uint8_t), BLOCK_SIZE, fileIn);
         if (bytesRead <= 0) {
             break;
         }
-        /* Determine unique bytes in current block */
-        for (size_t i = 0; i < bytesRead; i++) {
-            size_t index = bufferIn[i] & 0xff; /* Cast byte to unsigned integer */
-            weights[index]++;
+        count_bytes_weight(bufferIn, bytesRead, weights);
+    }
+}
+
+/*
+ * Adds the weight of each byte of a memory block to weights.
+ *
+ * Incrementing one counter array stalls on runs of equal bytes: each increment
+ * waits for the previous store to the same counter. So consecutive bytes are
+ * counted in HISTOGRAM_TABLES interleaved tables, which are summed up in the end
+ */
+void count_bytes_weight(const uint8_t* data, size_t size, long* weights) {
+    static_assert(HISTOGRAM_TABLES == 4, "the loop below distributes bytes over 4 tables");
+    while (size > 0) {
+        /* Counters of a chunk fit into 32 bits */
+        size_t chunkSize = size < HISTOGRAM_CHUNK_SIZE ? size : HISTOGRAM_CHUNK_SIZE;
+        uint32_t counts[HISTOGRAM_TABLES][UINT8_COUNT] = {{0}};
+
+        size_t i = 0;
+        for (; i + HISTOGRAM_TABLES <= chunkSize; i += HISTOGRAM_TABLES) {
+            counts[0][data[i]]++;
+            counts[1][data[i + 1]]++;
+            counts[2][data[i + 2]]++;
+            counts[3][data[i + 3]]++;
         }
+        for (; i < chunkSize; i++) {
+            counts[i % HISTOGRAM_TABLES][data[i]]++;
+        }
+
+        for (size_t j = 0; j < UINT8_COUNT; j++) {
+            weights[j] += (long) counts[0][j] + counts[1][j] + counts[2][j] + counts[3][j];
+        }
+        data += chunkSize;
+        size -= chunkSize;
     }
 }
 
@@ -51,19 +86,20 @@ int weights_comparator(const void *item_1, const void *item_2)
     }
 }
 
-HuffmanTreeNode* build_huffman_tree(FILE* fileIn) {
-    long weights[UINT8_COUNT] = {0};
-    find_bytes_weight(fileIn, weights);
-
+/*
+ * Builds a Huffman tree from bytes weights (an array of size 256,
+ * see find_bytes_weight())
+ */
+HuffmanTreeNode* build_huffman_tree(const long* weights) {
 #ifdef DEBUG
-    printf("Generated bytes weights:\n");
+    fprintf(stderr, "Generated bytes weights:\n");
     for (size_t i = 0; i < UINT8_COUNT; i++) {
         if (i != 0 && i % 16 == 0) {
-            printf("\n");
+            fprintf(stderr, "\n");
         }
-        printf("%ld\t", weights[i]);
+        fprintf(stderr, "%ld\t", weights[i]);
     }
-    printf("\n\n");
+    fprintf(stderr, "\n\n");
 #endif
     priority_queue *forest = create_priority_queue(UINT8_COUNT, &weights_comparator);
 
@@ -96,8 +132,9 @@ HuffmanTreeNode* build_huffman_tree(FILE* fileIn) {
         priority_queue_insert(forest, newNode);
     }
     HuffmanTreeNode* root = priority_queue_poll(forest);
+    free_priority_queue(&forest);
 #ifdef DEBUG
-        printf("Root tree node: weight %ld + %ld = %ld\n\n", root->left->weight,
+        fprintf(stderr, "Root tree node: weight %ld + %ld = %ld\n\n", root->left->weight,
                                             root->right->weight, root->weight);
 #endif
     return root;
@@ -107,11 +144,266 @@ void free_huffman_tree(HuffmanTreeNode* tree) {
     if (!tree) {
         return;
     }
-    if (!tree->left && !tree->right) { /* Tree leaf */
-        free(tree);
-        return;
-    }
-    /* Otherwise, it's a parent node */
     free_huffman_tree(tree->left);
     free_huffman_tree(tree->right);
+    free(tree);
+}
+
+static void find_code_lengths_rec(HuffmanTreeNode* tree, uint8_t* lengths, uint8_t depth) {
+    if (tree->hasValue) {
+        lengths[tree->uniqueByte] = depth;
+        return;
+    }
+    find_code_lengths_rec(tree->left, lengths, depth + 1);
+    find_code_lengths_rec(tree->right, lengths, depth + 1);
+}
+
+/*
+ * Given a huffman encoding tree, finds the code length (leaf depth) of each byte.
+ * lengths - an array of size 256, 0 for bytes which are not in the tree
+ */
+void find_code_lengths(HuffmanTreeNode* tree, uint8_t* lengths) {
+    memset(lengths, 0, UINT8_COUNT);
+    find_code_lengths_rec(tree, lengths, 0);
+}
+
+/*
+ * An item of a package-merge list: either a single symbol (a coin),
+ * or a package of two items of the previous list
+ */
+typedef struct {
+    uint64_t weight;
+    int16_t  symbol; /* -1 for packages */
+} MergeItem;
+
+static int merge_item_comparator(const void* item_1, const void* item_2) {
+    const MergeItem* a = item_1;
+    const MergeItem* b = item_2;
+    if (a->weight != b->weight) {
+        return a->weight < b->weight ? SMALLER : GREATER;
+    }
+    return a->symbol < b->symbol ? SMALLER : (a->symbol > b->symbol ? GREATER : EQUAL);
+}
+
+/*
+ * Finds optimal code lengths which do not exceed maxLength bits, using the package-merge
+ * algorithm. Each symbol is a coin of its weight, available at every length 1..maxLength.
+ * Starting from the deepest level, cheapest coins of a level are paired into packages,
+ * which are merged with the coins of the level above. The 2n - 2 cheapest items of the last
+ * list are taken, packages among them are unpacked level by level, and the code length
+ * of a symbol is the number of times its coin was taken.
+ *
+ * weights - an array of size **count** (for bytes, 256, see find_bytes_weight())
+ * lengths - result, an array of size **count**, 0 for symbols with zero weight
+ */
+void limit_code_lengths(const long* weights, size_t count, uint8_t* lengths, uint8_t maxLength) {
+    MergeItem* coins = malloc(count * sizeof(MergeItem));
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        lengths[i] = 0;
+        if (weights[i] != 0) {
+            coins[n].weight = weights[i];
+            coins[n].symbol = i;
+            n++;
+        }
+    }
+    assert(n >= 2 && n <= ((size_t) 1 << maxLength));
+    qsort(coins, n, sizeof(MergeItem), merge_item_comparator);
+
+    /* levels[0] is the deepest level, levels[maxLength - 1] is the level of length 1 codes */
+    MergeItem* levels[UINT8_MAX];
+    size_t levelSizes[UINT8_MAX];
+    levels[0] = malloc(n * sizeof(MergeItem));
+    memcpy(levels[0], coins, n * sizeof(MergeItem));
+    levelSizes[0] = n;
+
+    for (uint8_t level = 1; level < maxLength; level++) {
+        MergeItem* previous = levels[level - 1];
+        size_t packages = levelSizes[level - 1] / 2;
+        MergeItem* current = malloc((n + packages) * sizeof(MergeItem));
+
+        /* Merge coins with packages of the previous level, both are sorted by weight */
+        size_t coin = 0, package = 0, size = 0;
+        while (coin < n || package < packages) {
+            uint64_t packageWeight = package < packages ?
+                previous[2 * package].weight + previous[2 * package + 1].weight : UINT64_MAX;
+            if (coin < n && coins[coin].weight <= packageWeight) {
+                current[size++] = coins[coin++];
+            } else {
+                MergeItem item = {packageWeight, -1};
+                current[size++] = item;
+                package++;
+            }
+        }
+        levels[level] = current;
+        levelSizes[level] = size;
+    }
+
+    /* Take 2n - 2 cheapest items and unpack them down to the deepest level */
+    size_t taken = 2 * n - 2;
+    for (int level = maxLength - 1; level >= 0; level--) {
+        size_t packages = 0;
+        for (size_t i = 0; i < taken; i++) {
+            if (levels[level][i].symbol < 0) {
+                packages++;
+            } else {
+                lengths[levels[level][i].symbol]++;
+            }
+        }
+        taken = 2 * packages;
+        free(levels[level]);
+    }
+    free(coins);
+}
+
+/*
+ * Returns the number of bits all symbols take with the given code lengths
+ */
+uint64_t encoded_size(const long* weights, const uint8_t* lengths) {
+    uint64_t size = 0;
+    for (size_t i = 0; i < UINT8_COUNT; i++) {
+        size += (uint64_t) weights[i] * lengths[i];
+    }
+    return size;
+}
+
+/*
+ * Initializes canonical code fields of the heading from code lengths:
+ * the number of codes of each length and the symbols in canonical order
+ */
+void set_code_lengths(HuffmanHeading* heading, const uint8_t* lengths) {
+    memset(heading->lengthsCount, 0, sizeof(heading->lengthsCount));
+    heading->maxLength = 0;
+
+    size_t count = 0;
+    for (uint8_t length = 1; length <= HUFFMAN_MAX_CODE_LENGTH; length++) {
+        for (size_t i = 0; i < UINT8_COUNT; i++) {
+            if (lengths[i] != length) {
+                continue;
+            }
+            heading->symbols[count++] = i;
+            heading->lengthsCount[length]++;
+            heading->maxLength = length;
+        }
+    }
+    heading->symbolsCount = count - 1;
+}
+
+/*
+ * Serializes the number of codes of each length (except the longest) and the symbols
+ * in canonical order. Returns the number of bytes written (at most HUFFMAN_MAX_LENGTHS_SIZE)
+ */
+size_t write_code_lengths(const HuffmanHeading* heading, uint8_t* bytes) {
+    size_t size = 0;
+    for (uint8_t length = 1; length < heading->maxLength; length++) {
+        bytes[size++] = heading->lengthsCount[length];
+    }
+    memcpy(bytes + size, heading->symbols, heading->symbolsCount + 1);
+    return size + heading->symbolsCount + 1;
+}
+
+/*
+ * Reads what write_code_lengths() wrote. heading->maxLength and heading->symbolsCount
+ * must be already set. Returns the number of bytes read, or FAILURE if the bytes
+ * don't describe a valid code
+ */
+int read_code_lengths(HuffmanHeading* heading, const uint8_t* bytes, size_t size) {
+    uint8_t maxLength = heading->maxLength;
+    uint16_t symbolsCount = heading->symbolsCount + 1;
+    if (maxLength == 0 || maxLength > HUFFMAN_MAX_CODE_LENGTH || size < maxLength - 1 + symbolsCount) {
+        return FAILURE;
+    }
+
+    memset(heading->lengthsCount, 0, sizeof(heading->lengthsCount));
+    uint16_t implied = symbolsCount;
+    for (uint8_t length = 1; length < maxLength; length++) {
+        uint8_t count = bytes[length - 1];
+        if (count > implied) {
+            return FAILURE;
+        }
+        heading->lengthsCount[length] = count;
+        implied -= count;
+    }
+    heading->lengthsCount[maxLength] = implied;
+    memcpy(heading->symbols, bytes + maxLength - 1, symbolsCount);
+    return maxLength - 1 + symbolsCount;
+}
+
+/*
+ * Assigns canonical codes to heading symbols and writes them to the map
+ * (an array of size 256, indexed by byte value)
+ */
+void build_canonical_codes(const HuffmanHeading* heading, Sequence* map) {
+    memset(map, 0, UINT8_COUNT * sizeof(Sequence));
+
+    uint32_t code = 0;
+    size_t index = 0;
+    for (uint8_t length = 1; length <= heading->maxLength; length++) {
+        for (uint16_t i = 0; i < heading->lengthsCount[length]; i++) {
+            Sequence seq = {code, length};
+            map[heading->symbols[index++]] = seq;
+            code++;
+        }
+        code <<= 1;
+    }
+}
+
+static HuffmanTreeNode* make_node() {
+    HuffmanTreeNode* node = malloc(sizeof(HuffmanTreeNode));
+    node->uniqueByte = 0;
+    node->weight = 0;
+    node->hasValue = false;
+    node->left = NULL;
+    node->right = NULL;
+    return node;
+}
+
+/*
+ * Checks that every parent node has both children
+ */
+static bool is_tree_complete(HuffmanTreeNode* tree) {
+    if (tree->hasValue) {
+        return true;
+    }
+    if (!tree->left || !tree->right) {
+        return false;
+    }
+    return is_tree_complete(tree->left) && is_tree_complete(tree->right);
+}
+
+/*
+ * Builds a decoding tree from a map of codes. Returns NULL if the codes
+ * do not form a complete prefix code
+ */
+HuffmanTreeNode* build_tree_from_codes(const Sequence* map) {
+    HuffmanTreeNode* root = make_node();
+    for (size_t i = 0; i < UINT8_COUNT; i++) {
+        if (map[i].size == 0) {
+            continue;
+        }
+        HuffmanTreeNode* current = root;
+        for (size_t j = 0; j < map[i].size; j++) {
+            if (current->hasValue) { /* Code continues past another code */
+                free_huffman_tree(root);
+                return NULL;
+            }
+            uint8_t bit = (map[i].value >> (map[i].size - 1 - j)) & 1;
+            HuffmanTreeNode** next = bit == 0 ? &current->left : &current->right;
+            if (*next == NULL) {
+                *next = make_node();
+            }
+            current = *next;
+        }
+        if (current->hasValue || current->left || current->right) { /* Code is a prefix of another code */
+            free_huffman_tree(root);
+            return NULL;
+        }
+        current->hasValue = true;
+        current->uniqueByte = i;
+    }
+    if (!is_tree_complete(root)) {
+        free_huffman_tree(root);
+        return NULL;
+    }
+    return root;
 }
\ No newline at end of file
@@ -4,16 +4,38 @@
 #include <stdio.h>
 
 #include "../../common.h"
-#include "../../utils/linkedlist.h"
 
+/*
+ * Heading version. Version 0 archives have no version field, their first byte
+ * holds only ignoreBits (0-7); since version 1, the version is written to the
+ * high nibble of the first byte.
+ * Versions 0 and 1 store the tree as a pre-order shape bitmap and leaves,
+ * version 2 stores canonical code lengths
+ */
+#define HUFFMAN_VERSION 2
+#define HUFFMAN_VERSION_SHIFT 4
+#define HUFFMAN_IGNORE_BITS_MASK 0x0f
+
+#define HUFFMAN_MAX_CODE_LENGTH 32 /* Codes are kept in Sequence.value */
+#define HUFFMAN_MAX_LENGTHS_SIZE (HUFFMAN_MAX_CODE_LENGTH - 1 + UINT8_COUNT) /* Max size of serialized code lengths */
+
+/**
+ * Canonical Huffman code: codes are fully determined by the code length of
+ * each symbol. Symbols are ordered by code length, then by value; the first
+ * symbol gets the all-zero code, every next one gets the previous code plus one,
+ * shifted left when the code length grows
+ */
 typedef struct {
-    uint8_t ignoreBits;     /* 1 byte  - the number of additional bits to ignore in the end of arch. data */
-    uint8_t signature;      /* 1 byte  - signature */
-    uint8_t treeShapeSize;  /* 1 byte  - size of tree shape in bytes */
-    uint8_t treeLeavesSize; /* 1 byte  - size of tree leaves in bytes MINUS ONE (e.g. if size if 256, then 255 will be written) */
-    List*   treeShape;      /* X bytes - huffman tree shape */
-    List*   treeLeaves;     /* Y bytes - huffman tree leaves */
-    /* ... */               /* Z bytes - archived data (no field) */
+    uint8_t  version;        /* 4 bits  - heading version (high nibble of the first byte) */
+    uint8_t  ignoreBits;     /* 4 bits  - the number of additional bits to ignore in the end of arch. data */
+    uint8_t  signature;      /* 1 byte  - signature */
+    uint8_t  symbolsCount;   /* 1 byte  - number of coded symbols MINUS ONE (e.g. if there are 256, then 255 will be written) */
+    uint8_t  maxLength;      /* 1 byte  - length of the longest code in bits */
+    uint64_t originalSize;   /* 8 bytes - size of unarchived data in bytes, little-endian */
+    uint16_t lengthsCount[HUFFMAN_MAX_CODE_LENGTH + 1]; /* (maxLength - 1) bytes - number of codes of length 1, 2, ...
+                                                         * maxLength - 1 (the number of the longest codes is implied) */
+    uint8_t  symbols[UINT8_COUNT];                      /* (symbolsCount + 1) bytes - symbols in canonical order */
+    /* ... */                /* Z bytes - archived data (no field) */
 } HuffmanHeading;
 
 typedef struct HuffmanTreeNode {
@@ -26,7 +48,18 @@ typedef struct HuffmanTreeNode {
 } HuffmanTreeNode;
 
 void init_huffman_heading(HuffmanHeading* heading);
-HuffmanTreeNode* build_huffman_tree(FILE* fileIn);
+void find_bytes_weight(FILE* fileIn, long* weights);
+void count_bytes_weight(const uint8_t* data, size_t size, long* weights);
+HuffmanTreeNode* build_huffman_tree(const long* weights);
 void free_huffman_tree(HuffmanTreeNode* tree);
 
-#endif
\ No newline at end of file
+void find_code_lengths(HuffmanTreeNode* tree, uint8_t* lengths);
+void limit_code_lengths(const long* weights, size_t count, uint8_t* lengths, uint8_t maxLength);
+uint64_t encoded_size(const long* weights, const uint8_t* lengths);
+void set_code_lengths(HuffmanHeading* heading, const uint8_t* lengths);
+size_t write_code_lengths(const HuffmanHeading* heading, uint8_t* bytes);
+int read_code_lengths(HuffmanHeading* heading, const uint8_t* bytes, size_t size);
+void build_canonical_codes(const HuffmanHeading* heading, Sequence* map);
+HuffmanTreeNode* build_tree_from_codes(const Sequence* map);
+
+#endif
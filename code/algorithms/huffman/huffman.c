@@ -2,124 +2,84 @@
 
 #include "huffman.h"
 #include "heading.h"
+#include "decode_table.h"
 #include "../../archiver.h"
-#include "../../utils/linkedlist.h"
+#include "../../bitio.h"
+#include "../../blocks.h"
 
-static HuffmanHeading heading;
+static int encode_block(const uint8_t* src, size_t size, BitWriter* writer, const Data* data, BlockStats* stats);
+static int decode_block(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize, const Data* data);
+static size_t bound_block(size_t size);
 
-static void post() {
-    destroylist(heading.treeLeaves);
-    destroylist(heading.treeShape);
-}
+const BlockCodec huffmanBlockCodec = {SIG_HUFFMAN, encode_block, decode_block, bound_block};
 
-/*
- * Flattens tree structure
- */
-static void flatten_tree_shape(HuffmanTreeNode* tree) {
-    if (tree->hasValue) { /* Tree leaf */
-        list_add(false, heading.treeShape);
-        return;
-    }
-    /* Otherwise, it's a parent node */
-    list_add(true, heading.treeShape);
-    flatten_tree_shape(tree->left);
-    flatten_tree_shape(tree->right);
-}
+static void write_heading(const HuffmanHeading* heading) {
+    /* One empty byte, will be overwritten in the end of the program */
+    uint8_t byte = 0;
+    fwrite(&byte, sizeof(uint8_t), 1, fileOut);
 
-/*
- * Flattens tree leaves
- */
-static void flatten_tree_leaves(HuffmanTreeNode* tree) {
-    if (tree->hasValue) {
-        list_add(tree->uniqueByte, heading.treeLeaves);
-        return;
-    }
-    /* Otherwise, it's a parent node */
-    flatten_tree_leaves(tree->left);
-    flatten_tree_leaves(tree->right);
+    /* Other fields */
+    fwrite(&heading->signature, sizeof(uint8_t), 1, fileOut);
+    fwrite(&heading->symbolsCount, sizeof(uint8_t), 1, fileOut);
+    fwrite(&heading->maxLength, sizeof(uint8_t), 1, fileOut);
+    write_uint64(heading->originalSize, fileOut);
+
+    /* Writing the number of codes of each length and symbols in canonical order */
+    uint8_t bytes[HUFFMAN_MAX_LENGTHS_SIZE];
+    size_t size = write_code_lengths(heading, bytes);
+    fwrite(bytes, sizeof(uint8_t), size, fileOut);
 }
 
 /*
- * Given a huffman encoding tree, flattens it and initializes
- * heading.treeShape, treeLeaves, and their sizes
+ * Finds code lengths for the given weights, limits them to maxCodeLength bits, and
+ * initializes canonical code fields of the heading and the map of codes
+ *
+ * stats - result, payload size with and without the code length limit
  */
-static void flatten_tree(HuffmanTreeNode* tree) {
-    flatten_tree_shape(tree);
-    flatten_tree_leaves(tree);
-
-    /* Initialize tree shape size in bytes */
-    heading.treeShapeSize = list_size(heading.treeShape) / BYTE_SIZE;
-    if (list_size(heading.treeShape) % BYTE_SIZE != 0) { /* Round up if there's a remainder */
-        heading.treeShapeSize++;
+static void build_codes(const long* weights, uint8_t maxCodeLength, HuffmanHeading* codeHeading,
+                        Sequence* map, BlockStats* stats) {
+    uint8_t lengths[UINT8_COUNT] = {0};
+    size_t symbols = 0, lastSymbol = 0;
+    for (size_t i = 0; i < UINT8_COUNT; i++) {
+        if (weights[i] != 0) {
+            symbols++;
+            lastSymbol = i;
+        }
     }
-    /* Initialize tree leaves size in bytes */
-    heading.treeLeavesSize = list_size(heading.treeLeaves) - 1;
 
-#ifdef DEBUG
-    printf("Flat tree shape:\n");
-    list_display(heading.treeShape);
-    printf("Flat tree leaves:\n");
-    list_display(heading.treeLeaves);
-    printf("Tree shape size (in bytes): %d\n", heading.treeShapeSize);
-    printf("Tree leaves size (in bytes): %d\n\n", heading.treeLeavesSize + 1);
-#endif
-}
-
-static void write_heading() {
-    /* One empty byte, will be overwritten in the end of the program */
-    uint8_t byte = 0;
-    fwrite(&byte, sizeof(uint8_t), 1, fileOut);
+    if (symbols == 1) {
+        /* A single byte still needs a one-bit code, pair it with an unused one */
+        lengths[lastSymbol] = 1;
+        lengths[(lastSymbol + 1) % UINT8_COUNT] = 1;
+    } else {
+        HuffmanTreeNode* tree = build_huffman_tree(weights);
+        find_code_lengths(tree, lengths);
+        free_huffman_tree(tree);
+    }
+    stats->unlimitedPayloadBits = encoded_size(weights, lengths);
 
-    /* Other fields */
-    fwrite(&heading.signature, sizeof(uint8_t), 1, fileOut);
-    fwrite(&heading.treeShapeSize, sizeof(uint8_t), 1, fileOut);
-    fwrite(&heading.treeLeavesSize, sizeof(uint8_t), 1, fileOut);
-
-    /* Writing tree shape bytes */
-    for (size_t i = 0; i < heading.treeShapeSize; i++) {
-        byte = 0;
-        /* Generating each byte from 8 bits */
-        for (size_t j = 0; j < BYTE_SIZE; j++) {
-            bool bit = list_poll(heading.treeShape);
-            if (bit) {
-                byte |= (1 << (BYTE_SIZE - 1 - j));
-            }
-        }
-        /* Write current byte */
-        fwrite(&byte, sizeof(uint8_t), 1, fileOut);
+    uint8_t maxLength = 0;
+    for (size_t i = 0; i < UINT8_COUNT; i++) {
+        maxLength = lengths[i] > maxLength ? lengths[i] : maxLength;
     }
-    
-    /* Writing tree leaves bytes */
-    while (list_size(heading.treeLeaves) != 0) {
-        byte = list_poll(heading.treeLeaves);
-        fwrite(&byte, sizeof(uint8_t), 1, fileOut);
+    /* Tree is too deep, rebuild the lengths within the limit */
+    if (maxLength > maxCodeLength) {
+        limit_code_lengths(weights, UINT8_COUNT, lengths, maxCodeLength);
     }
+    stats->payloadBits = encoded_size(weights, lengths);
+
+    set_code_lengths(codeHeading, lengths);
+    build_canonical_codes(codeHeading, map);
 }
 
 /*
- * Given a huffman encoding tree, builds a map of all leaves and their values.
- * An array of ByteSequences (size = 256) represents the map. The index of each element
- * is a unique byte value. The value of each element is its encoded sequence of bits
- *
- * currentSeq - current sequence, which we are forming for the next leaf
- * size       - current sequence size
+ * Writes the codes of **size** bytes of src
  */
-static void build_map(HuffmanTreeNode* tree, Sequence* map, int currentSeq, int size) {
-    if (tree->hasValue) { /* We reached a tree leaf */
-        Sequence seq = {currentSeq, size};
-        map[tree->uniqueByte] = seq;
-        return;
+static void encode_bytes(BitWriter* writer, const Sequence* map, const uint8_t* src, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        Sequence seq = map[src[i]];
+        bit_writer_put(writer, seq.value, seq.size);
     }
-    /* Otherwise, we have a parent node */
-    currentSeq <<= 1; /* Shifting current path sequence one cell left */
-    size++;           /* Incrementing size of sequence */
-
-    /* First, moving left */
-    build_map(tree->left, map, currentSeq, size);
-
-    /* Then, moving right */
-    currentSeq |= 1;   /* Right => sequence has "1" added */
-    build_map(tree->right, map, currentSeq, size);
 }
 
 /*
@@ -130,222 +90,481 @@ static void build_map(HuffmanTreeNode* tree, Sequence* map, int currentSeq, int
  * returns - Number of additional bits added to the archive
  */
 static uint8_t compress(Sequence* map) {
-    size_t size = update_buffer();
-    Sequence seq = map[bufferIn[0] & 0xff];
-    bufferIndexIn = 0;
-
-    while (size > 0) {
-        output_bit_sequence(seq);
-        bufferIndexIn++;
-        if (bufferIndexIn == size) {
-            size = update_buffer();
-            if (size == 0) { /* End of the file */
-                break;
-            }
-            bufferIndexIn = 0;
+    BitWriter writer;
+    bit_writer_init(&writer, fileOut);
+
+    if (mappedIn.data != NULL) {
+        encode_bytes(&writer, map, mappedIn.data, mappedIn.size);
+    } else {
+        size_t size;
+        while ((size = update_buffer()) > 0) {
+            encode_bytes(&writer, map, bufferIn, size);
         }
-        seq = map[bufferIn[bufferIndexIn] & 0xff];
     }
-    flush_buffer();
-    return flush_incomplete_bytes();
+    uint8_t extraBits = bit_writer_finish(&writer);
+    bit_writer_free(&writer);
+    return extraBits;
 }
 
 /*
- * Rewrites the first byte in the archive file with ignoreBits
+ * Rewrites the first byte in the archive file with heading version and ignoreBits
  */
-static void overwrite_ignore_bits(FILE* file) {
+static void overwrite_ignore_bits(FILE* file, const HuffmanHeading* heading) {
+    uint8_t byte = (heading->version << HUFFMAN_VERSION_SHIFT) | heading->ignoreBits;
     fseek(file, 0, SEEK_SET);
-    fwrite(&heading.ignoreBits, sizeof(uint8_t), 1, file);
+    fwrite(&byte, sizeof(uint8_t), 1, file);
+}
+
+/*
+ * Archives a block: the number of symbols and the max code length (1 byte each) and
+ * code lengths, as in the heading, followed by the codes of block bytes
+ */
+static int encode_block(const uint8_t* src, size_t size, BitWriter* writer, const Data* data, BlockStats* stats) {
+    long weights[UINT8_COUNT] = {0};
+    count_bytes_weight(src, size, weights);
+
+    HuffmanHeading blockHeading;
+    init_huffman_heading(&blockHeading);
+    Sequence map[UINT8_COUNT];
+    build_codes(weights, data->maxCodeLength, &blockHeading, map, stats);
+
+    uint8_t bytes[HUFFMAN_MAX_LENGTHS_SIZE];
+    size_t lengthsSize = write_code_lengths(&blockHeading, bytes);
+    bit_writer_put(writer, blockHeading.symbolsCount, BYTE_SIZE);
+    bit_writer_put(writer, blockHeading.maxLength, BYTE_SIZE);
+    for (size_t i = 0; i < lengthsSize; i++) {
+        bit_writer_put(writer, bytes[i], BYTE_SIZE);
+    }
+
+    encode_bytes(writer, map, src, size);
+    bit_writer_finish(writer);
+    return 0;
+}
+
+/*
+ * Codes of a block are at most 8 bits long on average (a fixed-length code is never better
+ * than the Huffman one), so a block grows by its code description at most
+ */
+static size_t bound_block(size_t size) {
+    return 2 + HUFFMAN_MAX_LENGTHS_SIZE + size;
 }
 
 int huffman_archive(Data* data) {
+    /*
+     * Single-stream archives read the input three times and patch the first byte
+     * of the output, so pipes are archived block by block in one pass
+     */
+    if (data->blockSize == 0 && (!is_regular_file(fileIn) || !is_regular_file(fileOut))) {
+        data->blockSize = DEFAULT_BLOCK_SIZE;
+    }
+    if (data->blockSize != 0) {
+        return blocks_archive(data, &huffmanBlockCodec);
+    }
+    HuffmanHeading heading;
     init_huffman_heading(&heading);
 
-    if (!is_file_correct(fileIn)) {
+    long weights[UINT8_COUNT] = {0};
+    if (mappedIn.data != NULL) {
+        count_bytes_weight(mappedIn.data, mappedIn.size, weights);
+    } else {
+        find_bytes_weight(fileIn, weights);
+    }
+
+    size_t uniqueBytes = 0;
+    for (size_t i = 0; i < UINT8_COUNT; i++) {
+        uniqueBytes += weights[i] != 0;
+    }
+    if (uniqueBytes < 2) {
         archiveError("incorrect file: contains less than 2 unique bytes");
         return FAILURE;
     }
-    fseek(fileIn, 0, SEEK_SET);
 
-    HuffmanTreeNode* tree = build_huffman_tree(fileIn);
-    flatten_tree(tree);
-    write_heading();
-    Sequence map[UINT8_COUNT] = {0};
-    build_map(tree, map, 0, 0);
+    Sequence map[UINT8_COUNT];
+    BlockStats stats;
+    build_codes(weights, data->maxCodeLength, &heading, map, &stats);
+    if (stats.payloadBits != stats.unlimitedPayloadBits) {
+        data->lengthLimitLoss = ((double) stats.payloadBits / stats.unlimitedPayloadBits - 1) * 100;
+    }
+    heading.originalSize = data->fileInSize;
+    write_heading(&heading);
 
 #ifdef DEBUG
-    printf("Generated tree map:\n");
+    fprintf(stderr, "Generated tree map:\n");
     for (size_t i = 0; i < UINT8_COUNT; i++) {
         if (i != 0 && i % 16 == 0) {
-            printf("\n");
+            fprintf(stderr, "\n");
         }
-        printf("(%x %ld)\t", map[i].value, map[i].size);
+        fprintf(stderr, "(%x %ld)\t", map[i].value, map[i].size);
     }
-    printf("\n\n");
+    fprintf(stderr, "\n\n");
 #endif
     fseek(fileIn, 0, SEEK_SET);
     heading.ignoreBits = compress(map);
 
 #ifdef DEBUG
-    printf("ignoreBits: %d\n\n", heading.ignoreBits);
+    fprintf(stderr, "ignoreBits: %d\n\n", heading.ignoreBits);
 #endif
-    free_huffman_tree(tree);
-    post();
-    overwrite_ignore_bits(fileOut);
+    overwrite_ignore_bits(fileOut, &heading);
     return 0;
 }
 
+/*
+ * Pre-order tree shape (1 - parent node, 0 - leaf) and leaves,
+ * as stored by version 0 and 1 headings
+ */
+typedef struct {
+    uint8_t shape[UINT8_MAX];
+    size_t  shapeBits;
+    size_t  shapeIndex;
+    uint8_t leaves[UINT8_COUNT];
+    size_t  leavesCount;
+    size_t  leavesIndex;
+} FlatTree;
+
 /*
  * Given tree shape and leaves, unflattens tree and returns it
  */
-static HuffmanTreeNode* unflatten_tree(List* treeShape, List* treeLeaves) {
-    if (list_size(treeShape) == 0) {
+static HuffmanTreeNode* unflatten_tree(FlatTree* flat) {
+    if (flat->shapeIndex >= flat->shapeBits || flat->leavesIndex >= flat->leavesCount) {
         return NULL;
     }
-    bool bit = list_poll(treeShape);
+    size_t index = flat->shapeIndex++;
+    bool bit = (flat->shape[index / BYTE_SIZE] >> (BYTE_SIZE - 1 - index % BYTE_SIZE)) & 1;
+
+    HuffmanTreeNode* node = malloc(sizeof(HuffmanTreeNode));
+    node->left = NULL;
+    node->right = NULL;
 
     /* Current bit indicates it's a leaf node */
     if (!bit) {
-        HuffmanTreeNode* leaf = malloc(sizeof(HuffmanTreeNode));
-        leaf->uniqueByte = list_poll(treeLeaves);
-        leaf->hasValue = true;
-        leaf->left = NULL;
-        leaf->right = NULL;
-        return leaf;
+        node->uniqueByte = flat->leaves[flat->leavesIndex++];
+        node->hasValue = true;
+        return node;
     }
 
     /* Otherwise, we have a parent node */
-    HuffmanTreeNode* parent = malloc(sizeof(HuffmanTreeNode));
-    parent->hasValue = false;
-    parent->left = unflatten_tree(treeShape, treeLeaves);
-    parent->right = unflatten_tree(treeShape, treeLeaves);
-    return parent;
+    node->hasValue = false;
+    node->left = unflatten_tree(flat);
+    node->right = unflatten_tree(flat);
+    if (!node->left || !node->right) { /* Malformed shape */
+        free_huffman_tree(node);
+        return NULL;
+    }
+    return node;
 }
 
 /*
- * Given the encoding tree shape and leaves size, read it from the file,
- * unflattens and returns the result
+ * Given the encoding tree shape and leaves size, read it from the file (version 0 and 1
+ * headings), unflattens and returns the result
  */
-static HuffmanTreeNode* get_tree(uint16_t shapeSize, uint16_t leavesSize) {
-    List* shape = makelist();
-    List* leaves = makelist();
-
-    /* Read tree shape */
-    for (size_t i = 0; i < shapeSize; i++) {
-        uint8_t byte;
-        fread(&byte, sizeof(uint8_t), 1, fileIn);
-
-        /* Generate 8 bits and put them to shape array */
-        for (size_t j = 0; j < BYTE_SIZE; j++) {
-            uint8_t bit = (byte >> (BYTE_SIZE - j - 1)) & 1;
-            if (bit == 1) {
-                list_add(true, shape);
-            } else {
-                list_add(false, shape);
-            }
-        }
-    }
+static HuffmanTreeNode* get_flat_tree(uint16_t shapeSize, uint16_t leavesSize) {
+    FlatTree flat;
+    flat.shapeBits = shapeSize * BYTE_SIZE;
+    flat.shapeIndex = 0;
+    flat.leavesCount = leavesSize;
+    flat.leavesIndex = 0;
+    fread(flat.shape, sizeof(uint8_t), shapeSize, fileIn);
+    fread(flat.leaves, sizeof(uint8_t), leavesSize, fileIn);
+    return unflatten_tree(&flat);
+}
+
+/*
+ * Reads canonical code lengths and symbols (version 2+ headings), rebuilds
+ * the codes and returns the decoding tree
+ */
+static HuffmanTreeNode* get_canonical_tree(uint16_t symbolsCount, uint8_t maxLength) {
+    HuffmanHeading heading;
+    init_huffman_heading(&heading);
+    heading.maxLength = maxLength;
+    heading.symbolsCount = symbolsCount - 1;
 
-    /* Read tree leaves */
-    for (size_t i = 0; i < leavesSize; i++) {
-        uint8_t byte;
-        fread(&byte, sizeof(uint8_t), 1, fileIn);
-        list_add(byte, leaves);
+    /* The size of the lengths depends on maxLength, so it's checked before they're read */
+    if (maxLength == 0 || maxLength > HUFFMAN_MAX_CODE_LENGTH) {
+        return NULL;
     }
+    uint8_t bytes[HUFFMAN_MAX_LENGTHS_SIZE];
+    size_t lengthsSize = maxLength - 1 + symbolsCount;
+    if (lengthsSize > sizeof(bytes)) {
+        return NULL;
+    }
+    size_t size = fread(bytes, sizeof(uint8_t), lengthsSize, fileIn);
+    if (read_code_lengths(&heading, bytes, size) == FAILURE) {
+        return NULL;
+    }
+
+    Sequence map[UINT8_COUNT];
+    build_canonical_codes(&heading, map);
 #ifdef DEBUG
-    printf("Read flat tree shape from file:\n");
-    list_display(shape);
-    printf("Read flat tree leaves from file:\n");
-    list_display(leaves);
-    printf("Tree shape size (in bytes): %d\n", shapeSize);
-    printf("Tree leaves size (in bytes): %d\n\n", leavesSize);
+    fprintf(stderr, "Read canonical codes:\n");
+    for (size_t i = 0; i < UINT8_COUNT; i++) {
+        if (i != 0 && i % 16 == 0) {
+            fprintf(stderr, "\n");
+        }
+        fprintf(stderr, "(%x %ld)\t", map[i].value, map[i].size);
+    }
+    fprintf(stderr, "\n\n");
 #endif
-    return unflatten_tree(shape, leaves);
+    return build_tree_from_codes(map);
 }
 
+typedef struct {
+    DecoderType      type;
+    HuffmanTreeNode* tree;
+    DecodeTables     tables;      /* Lookup tables (DEC_TABLE only) */
+    BitReader        reader;
+    uint64_t         bitsRead;    /* Number of bits decoded so far */
+    uint64_t         payloadBits; /* Number of meaningful bits of archived data (to cut redundant bits in the end) */
+} HuffmanDecoder;
+
 /*
- * Given a buffer of bytes with a specified blocks size, decompresses info there according to the
- * huffman encoding tree and writes it into the output stream
- *
- * tree - Huffman encoding tree
- * ignoreBits - Bits to ignore in the last element of buffer (to cut redundant bytes in the end of file)
+ * Initializes a decoder, which takes ownership of the tree.
+ * The bit reader must be initialized separately
  */
-static void decompress(HuffmanTreeNode* tree, uint8_t ignoreBits) {
-    uint8_t bitIndex = 0;           /* Index of current bit in buffer's byte (0-7) */
-    size_t  size = update_buffer(); /* Update buffer and get the size of bytes read from file */
+static void init_decoder(HuffmanDecoder* decoder, HuffmanTreeNode* tree, DecoderType type, uint64_t payloadBits) {
+    decoder->type = type;
+    decoder->tree = tree;
+    if (type == DEC_TABLE) {
+        build_decode_tables(tree, &decoder->tables);
+    }
+    decoder->bitsRead = 0;
+    decoder->payloadBits = payloadBits;
+}
+
+static void free_decoder(HuffmanDecoder* decoder) {
+    if (decoder->type == DEC_TABLE) {
+        free_decode_tables(&decoder->tables);
+    }
+    free_huffman_tree(decoder->tree);
+    bit_reader_free(&decoder->reader);
+}
+
+/*
+ * Decodes up to **count** bytes to dst, moving through the huffman encoding tree
+ * bit by bit. Returns the number of decoded bytes
+ */
+static size_t decode_tree(HuffmanDecoder* decoder, uint8_t* dst, size_t count) {
+    BitReader reader = decoder->reader;
+    uint64_t bitsRead = decoder->bitsRead;
+    size_t i;
     /*
      * Each iteration:
      * 1. Going through Huffman tree until reaching a leaf
      * 2. Get leaf's value
      * 3. Write it to output stream
      */
-    while (size != 0) {
-        HuffmanTreeNode* currentNode = tree;
+    for (i = 0; i < count && bitsRead < decoder->payloadBits; i++) {
+        HuffmanTreeNode* currentNode = decoder->tree;
 
         /* Forming a unique combination and fetching its value from the tree */
         while (!currentNode->hasValue) {
-            /* Fetching current bit from the buffer */
-            uint32_t bit = ((0b10000000 >> bitIndex) & bufferIn[bufferIndexIn]) >> (BYTE_SIZE - 1 - bitIndex);
-
-            /* Check the value (either 1 or 0) */
-            if (bit == 0) {
+            /* Check the value of the next bit (either 1 or 0) */
+            if (bit_reader_read(&reader, 1) == 0) {
                 currentNode = currentNode->left;
             } else {
                 currentNode = currentNode->right;
             }
+            bitsRead++;
+        }
+        /* We've found the value of current bit combination */
+        dst[i] = currentNode->uniqueByte;
+    }
+    decoder->reader = reader;
+    decoder->bitsRead = bitsRead;
+    return i;
+}
 
-            /* Check if we should ignore all the next bits in this byte */
-            if (bufferIndexIn == size - 1 && bitIndex == BYTE_SIZE - 1 - ignoreBits && at_end(fileIn)) {
-                size = 0;
+/*
+ * Table-driven counterpart of decode_tree(). Instead of moving through the tree
+ * bit by bit, each probe looks up the next DECODE_ROOT_BITS bits in a table, which
+ * resolves a whole codeword at once (longer codewords continue in next-level tables)
+ */
+static size_t decode_table(HuffmanDecoder* decoder, uint8_t* dst, size_t count) {
+    const DecodeTable* tables = decoder->tables.tables;
+    const DecodeEntry* entries = decoder->tables.entries;
+    BitReader reader = decoder->reader;
+    uint64_t bitsRead = decoder->bitsRead;
+    size_t i;
+
+    for (i = 0; i < count && bitsRead < decoder->payloadBits; i++) {
+        const DecodeTable* table = &tables[0];
+        while (true) {
+            DecodeEntry entry = entries[table->offset + bit_reader_peek(&reader, table->bits)];
+            if (entry.next == 0) { /* Whole codeword resolved */
+                bit_reader_consume(&reader, entry.length);
+                bitsRead += entry.length;
+                dst[i] = entry.symbol;
                 break;
             }
+            /* Codeword is longer, continue with the next-level table */
+            bit_reader_consume(&reader, table->bits);
+            bitsRead += table->bits;
+            table = &tables[entry.next];
+        }
+    }
+    decoder->reader = reader;
+    decoder->bitsRead = bitsRead;
+    return i;
+}
 
-            /* Moving to the next byte in buffer */
-            if (bitIndex == BYTE_SIZE - 1) {
-                bufferIndexIn++;
-                bitIndex = 0;
+static size_t decode_symbols(HuffmanDecoder* decoder, uint8_t* dst, size_t count) {
+    if (decoder->type == DEC_TREE) {
+        return decode_tree(decoder, dst, count);
+    }
+    return decode_table(decoder, dst, count);
+}
 
-                /* Update buffer if it ended */
-                if (bufferIndexIn >= size) {
-                    size = update_buffer();
-                    bufferIndexIn = 0;
-                }
-            }
-            /* Otherwise, moving to the next bit in current buffer's byte */
-            else {
-                bitIndex++;
-            }
+/*
+ * Decompresses archived data of a single-stream archive and writes it into the output stream
+ *
+ * symbolsCount - Number of bytes to decompress, UINT64_MAX if it's unknown (version 0).
+ * Returns FAILURE if archived data ends before symbolsCount bytes are decompressed
+ */
+static int decompress(HuffmanDecoder* decoder, uint64_t symbolsCount) {
+    bool isSizeKnown = symbolsCount != UINT64_MAX;
+    while (symbolsCount > 0) {
+        size_t count = symbolsCount < BLOCK_SIZE ? symbolsCount : BLOCK_SIZE;
+        size_t decoded = decode_symbols(decoder, bufferOut, count);
+        if (bit_reader_overrun(&decoder->reader)) {
+            return FAILURE;
+        }
+        fwrite(bufferOut, sizeof(uint8_t), decoded, fileOut);
+        if (decoded < count) { /* End of archived data */
+            return isSizeKnown ? FAILURE : 0;
         }
-        /* We've found the value of current bit combination, writing it to the buffer */
-        output_byte(currentNode->uniqueByte);
+        symbolsCount -= decoded;
+    }
+    return 0;
+}
+
+/*
+ * Unarchives a block written by encode_block()
+ */
+static int decode_block(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize, const Data* data) {
+    if (srcSize < 2) {
+        return FAILURE;
+    }
+    HuffmanHeading blockHeading;
+    init_huffman_heading(&blockHeading);
+    blockHeading.symbolsCount = src[0];
+    blockHeading.maxLength = src[1];
+    int lengthsSize = read_code_lengths(&blockHeading, src + 2, srcSize - 2);
+    if (lengthsSize == FAILURE) {
+        return FAILURE;
+    }
+
+    Sequence map[UINT8_COUNT];
+    build_canonical_codes(&blockHeading, map);
+    HuffmanTreeNode* tree = build_tree_from_codes(map);
+    if (tree == NULL) {
+        return FAILURE;
     }
-    /* Flush the rest of the output buffer */
-    flush_buffer();
+
+    size_t headingSize = 2 + lengthsSize;
+    HuffmanDecoder decoder;
+    init_decoder(&decoder, tree, data->decoderType, (uint64_t) (srcSize - headingSize) * BYTE_SIZE);
+    bit_reader_init_memory(&decoder.reader, src + headingSize, srcSize - headingSize);
+    size_t decoded = decode_symbols(&decoder, dst, dstSize);
+    free_decoder(&decoder);
+    return decoded == dstSize ? 0 : FAILURE;
+}
+
+/*
+ * Unarchives data->rangeLength bytes of the original file from data->rangeOffset.
+ * Only block archives support it
+ */
+int huffman_extract(Data* data) {
+    uint8_t firstByte, signature;
+    fread(&firstByte, sizeof(uint8_t), 1, fileIn);
+    fread(&signature, sizeof(uint8_t), 1, fileIn);
+    if (signature != SIG_HUFFMAN) {
+        archiveError("invalid archive");
+        return FAILURE;
+    }
+    if (firstByte >> BLOCKS_VERSION_SHIFT != BLOCKS_VERSION) {
+        archiveError("range unarchiving needs an archive made with --block-size or --threads");
+        return FAILURE;
+    }
+    return blocks_extract(data, &huffmanBlockCodec, data->rangeOffset, data->rangeLength);
 }
 
 int huffman_unarchive(Data* data) {
     /* Read first two heading fields */
-    uint8_t ignoreBits, signature;
-    fread(&ignoreBits, sizeof(uint8_t), 1, fileIn);
+    uint8_t firstByte, signature;
+    fread(&firstByte, sizeof(uint8_t), 1, fileIn);
     fread(&signature, sizeof(uint8_t), 1, fileIn);
+    uint8_t version = firstByte >> HUFFMAN_VERSION_SHIFT;
+    uint8_t ignoreBits = firstByte & HUFFMAN_IGNORE_BITS_MASK;
 #ifdef DEBUG
-    printf("Ignore bits: %d\n", ignoreBits);
-    printf("Signature: 0x%x\n", signature);
+    fprintf(stderr, "Version: %d\n", version);
+    fprintf(stderr, "Ignore bits: %d\n", ignoreBits);
+    fprintf(stderr, "Signature: 0x%x\n", signature);
 #endif
     /* Check signature */
-    if (signature != SIG_HUFFMAN) {
+    if (signature != SIG_HUFFMAN || (version > HUFFMAN_VERSION && version != BLOCKS_VERSION) ||
+        ignoreBits >= BYTE_SIZE) {
+        archiveError("invalid archive");
+        return FAILURE;
+    }
+    if (version == BLOCKS_VERSION) {
+        return blocks_unarchive(data, &huffmanBlockCodec);
+    }
+
+    /* Read the rest of heading fields */
+    uint16_t sizeA = 0, sizeB = 0; /* Tree shape and leaves sizes, or symbols count and max code length */
+    fread(&sizeA, sizeof(uint8_t), 1, fileIn);
+    fread(&sizeB, sizeof(uint8_t), 1, fileIn);
+
+    /*
+     * Version 1+ archives know how many bytes to decompress. For older ones,
+     * the end of data is found from the archive size and ignoreBits
+     */
+    uint64_t symbolsCount = UINT64_MAX;
+    uint64_t payloadBits = UINT64_MAX;
+    if (version >= 1) {
+        symbolsCount = read_uint64(fileIn);
+    } else if (data->fileInSize == FAILURE) {
+        archiveError("version 0 archives can't be unarchived from a pipe");
+        return FAILURE;
+    } else {
+        long headingSize = 4 + sizeA + sizeB + 1;
+        payloadBits = (uint64_t) (data->fileInSize - headingSize) * BYTE_SIZE - ignoreBits;
+    }
+
+    HuffmanTreeNode* tree;
+    if (version >= 2) {
+        tree = get_canonical_tree(sizeA + 1, sizeB);
+    } else {
+        tree = get_flat_tree(sizeA, sizeB + 1);
+    }
+    if (tree == NULL) {
         archiveError("invalid archive");
         return FAILURE;
     }
 
-    /* Read last four heading fields */
-    uint16_t treeShapeSize = 0, treeLeavesSize = 0;
-    fread(&treeShapeSize, sizeof(uint8_t), 1, fileIn);
-    fread(&treeLeavesSize, sizeof(uint8_t), 1, fileIn);
-    treeLeavesSize++;
-    HuffmanTreeNode* tree = get_tree(treeShapeSize, treeLeavesSize);
+    /* The data of archives in regular files ends with the file, so truncated ones are found */
+    if (version >= 1 && is_regular_file(fileIn)) {
+        long position = ftell(fileIn);
+        if (position > data->fileInSize || (uint64_t) (data->fileInSize - position) * BYTE_SIZE < ignoreBits) {
+            free_huffman_tree(tree);
+            archiveError("invalid archive");
+            return FAILURE;
+        }
+        payloadBits = (uint64_t) (data->fileInSize - position) * BYTE_SIZE - ignoreBits;
+    }
 
     /* Decompress file */
-    decompress(tree, ignoreBits);
-    free_huffman_tree(tree);
-}
\ No newline at end of file
+    HuffmanDecoder decoder;
+    init_decoder(&decoder, tree, data->decoderType, payloadBits);
+    if (mappedIn.data != NULL) {
+        long position = ftell(fileIn);
+        bit_reader_init_memory(&decoder.reader, mappedIn.data + position, mappedIn.size - position);
+    } else {
+        bit_reader_init(&decoder.reader, fileIn);
+    }
+    int success = decompress(&decoder, symbolsCount);
+    free_decoder(&decoder);
+    if (success != 0) {
+        archiveError("invalid archive");
+    }
+    return success;
+}
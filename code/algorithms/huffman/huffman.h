@@ -5,8 +5,12 @@
 
 #include "../../common.h"
 #include "../../data.h"
+#include "../../blocks.h"
+
+extern const BlockCodec huffmanBlockCodec;
 
 int huffman_archive(Data* data);
 int huffman_unarchive(Data* data);
+int huffman_extract(Data* data);
 
 #endif
\ No newline at end of file
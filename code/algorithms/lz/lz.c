@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz.h"
+#include "match_finder.h"
+#include "../huffman/heading.h"
+#include "../huffman/block_codes.h"
+#include "../../bitio.h"
+
+/*
+ * Archived block: 1 byte - LZ_BLOCK_STORED, followed by the block bytes as they are,
+ * or LZ_BLOCK_CODED, followed by bits:
+ * 9 bits - number of literal/length code lengths (the lengths of the rest of the codes are 0)
+ * 6 bits - number of distance code lengths
+ * 4 bits - each code length, literal/length ones first
+ * Codes of literals and matches, until the block is complete. A match is a length
+ * code (after the codes of 256 literals) with its extra bits, then a distance code
+ * with its extra bits
+ */
+#define LZ_BLOCK_STORED 0
+#define LZ_BLOCK_CODED  1
+
+/*
+ * Lengths (minus LZ_MIN_MATCH) and distances (minus 1) are sent as a code and extra bits.
+ * Values below LZ_DIRECT_CODES are codes themselves. Larger ones get two codes per power
+ * of two, by their second highest bit, and the bits below it are the extra bits
+ */
+#define LZ_DIRECT_CODES   4
+#define LZ_LENGTH_CODES   32                     /* Up to LZ_MAX_MATCH */
+#define LZ_LITERAL_CODES  (UINT8_COUNT + LZ_LENGTH_CODES)
+#define LZ_DISTANCE_CODES (2 * LZ_WINDOW_BITS)   /* Up to LZ_MAX_DISTANCE */
+
+#define LZ_LITERAL_COUNT_BITS   9
+#define LZ_DISTANCE_COUNT_BITS  6
+
+/* What a literal costs in match_score units */
+#define LZ_LITERAL_SCORE        135
+
+static int encode_block(const uint8_t* src, size_t size, BitWriter* writer, const Data* data, BlockStats* stats);
+static int decode_block(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize, const Data* data);
+static size_t bound_block(size_t size);
+
+const BlockCodec lzBlockCodec = {SIG_LZ, encode_block, decode_block, bound_block};
+
+/* Levels trade the depth of match search for speed */
+static const LzLevel lzLevels[MAX_LEVEL + 1] = {
+    /* chainLength, niceLength, lazy */
+    [1] = {4,    16,           false},
+    [2] = {8,    32,           false},
+    [3] = {16,   32,           false},
+    [4] = {16,   32,           true},
+    [5] = {32,   64,           true},
+    [6] = {64,   128,          true},
+    [7] = {128,  256,          true},
+    [8] = {512,  1024,         true},
+    [9] = {4096, LZ_MAX_MATCH, true},
+};
+
+typedef struct {
+    uint32_t literals; /* Number of literals before the match */
+    uint32_t length;   /* 0 for the literals in the end of the block */
+    uint32_t distance;
+} LzSequence;
+
+typedef struct {
+    LzSequence* items;
+    size_t      count;
+    size_t      capacity;
+} LzSequences;
+
+static void add_sequence(LzSequences* sequences, uint32_t literals, uint32_t length, uint32_t distance) {
+    if (sequences->count == sequences->capacity) {
+        sequences->capacity = sequences->capacity == 0 ? 1024 : sequences->capacity * 2;
+        sequences->items = realloc(sequences->items, sequences->capacity * sizeof(LzSequence));
+    }
+    LzSequence sequence = {literals, length, distance};
+    sequences->items[sequences->count++] = sequence;
+}
+
+/*
+ * Splits a block into literals and matches. Greedy parsing takes the best match
+ * at each position; lazy parsing first checks if the next position has a better one
+ */
+static void parse(const uint8_t* src, size_t size, const LzLevel* level, LzSequences* sequences) {
+    MatchFinder finder;
+    match_finder_init(&finder, src, size);
+    size_t position = 0;
+    size_t literalsStart = 0;
+    while (position < size) {
+        LzMatch match = match_finder_find(&finder, position, level, LZ_MIN_MATCH);
+        if (match.length == 0) {
+            position++;
+            continue;
+        }
+        while (level->lazy && match.length < level->niceLength) {
+            LzMatch next = match_finder_find(&finder, position + 1, level, match.length + 1);
+            /* The match is deferred only if the next one pays for the extra literal */
+            if (next.length == 0 || match_score(next.length, next.distance) - LZ_LITERAL_SCORE
+                    <= match_score(match.length, match.distance)) {
+                break;
+            }
+            position++;
+            match = next;
+        }
+        add_sequence(sequences, position - literalsStart, match.length, match.distance);
+        position += match.length;
+        literalsStart = position;
+    }
+    add_sequence(sequences, size - literalsStart, 0, 0);
+    match_finder_free(&finder);
+}
+
+/*
+ * Returns the code of a length or distance value and the number of its extra bits
+ */
+static uint8_t value_code(uint32_t value, uint8_t* extraBits) {
+    if (value < LZ_DIRECT_CODES) {
+        *extraBits = 0;
+        return value;
+    }
+    uint8_t highBit = 31 - __builtin_clz(value);
+    *extraBits = highBit - 1;
+    return 2 * highBit + ((value >> (highBit - 1)) & 1);
+}
+
+static void put_value(BitWriter* writer, const Sequence* codes, uint32_t value) {
+    uint8_t extraBits;
+    uint8_t code = value_code(value, &extraBits);
+    bit_writer_put(writer, codes[code].value, codes[code].size);
+    if (extraBits > 0) {
+        bit_writer_put(writer, value & ((1u << extraBits) - 1), extraBits);
+    }
+}
+
+/*
+ * Archives a block: finds matches, builds Huffman codes for literals and lengths
+ * and for distances, and writes the codes. Blocks which don't get smaller are stored
+ */
+static int encode_block(const uint8_t* src, size_t size, BitWriter* writer, const Data* data, BlockStats* stats) {
+    stats->payloadBits = 0;
+    stats->unlimitedPayloadBits = 0;
+
+    LzSequences sequences = {NULL, 0, 0};
+    parse(src, size, &lzLevels[data->level], &sequences);
+
+    long literalWeights[LZ_LITERAL_CODES] = {0};
+    long distanceWeights[LZ_DISTANCE_CODES] = {0};
+    uint64_t extraBits = 0;
+    const uint8_t* literals = src;
+    for (size_t i = 0; i < sequences.count; i++) {
+        const LzSequence* sequence = &sequences.items[i];
+        count_bytes_weight(literals, sequence->literals, literalWeights);
+        literals += sequence->literals + sequence->length;
+        if (sequence->length == 0) {
+            continue;
+        }
+        uint8_t bits;
+        literalWeights[UINT8_COUNT + value_code(sequence->length - LZ_MIN_MATCH, &bits)]++;
+        extraBits += bits;
+        distanceWeights[value_code(sequence->distance - 1, &bits)]++;
+        extraBits += bits;
+    }
+
+    uint8_t literalLengths[LZ_LITERAL_CODES];
+    uint8_t distanceLengths[LZ_DISTANCE_CODES];
+    build_block_code_lengths(literalWeights, LZ_LITERAL_CODES, literalLengths);
+    build_block_code_lengths(distanceWeights, LZ_DISTANCE_CODES, distanceLengths);
+    size_t literalCount = used_block_codes(literalLengths, LZ_LITERAL_CODES);
+    size_t distanceCount = used_block_codes(distanceLengths, LZ_DISTANCE_CODES);
+
+    uint64_t bits = LZ_LITERAL_COUNT_BITS + LZ_DISTANCE_COUNT_BITS +
+                    (literalCount + distanceCount) * BLOCK_CODE_LENGTH_BITS + extraBits;
+    for (size_t i = 0; i < LZ_LITERAL_CODES; i++) {
+        bits += (uint64_t) literalWeights[i] * literalLengths[i];
+    }
+    for (size_t i = 0; i < LZ_DISTANCE_CODES; i++) {
+        bits += (uint64_t) distanceWeights[i] * distanceLengths[i];
+    }
+    if ((bits + BYTE_SIZE - 1) / BYTE_SIZE >= size) {
+        bit_writer_put(writer, LZ_BLOCK_STORED, BYTE_SIZE);
+        bit_writer_put_bytes(writer, src, size);
+        free(sequences.items);
+        return 0;
+    }
+
+    Sequence literalCodes[LZ_LITERAL_CODES];
+    Sequence distanceCodes[LZ_DISTANCE_CODES];
+    build_block_codes(literalLengths, LZ_LITERAL_CODES, literalCodes);
+    build_block_codes(distanceLengths, LZ_DISTANCE_CODES, distanceCodes);
+
+    bit_writer_put(writer, LZ_BLOCK_CODED, BYTE_SIZE);
+    bit_writer_put(writer, literalCount, LZ_LITERAL_COUNT_BITS);
+    bit_writer_put(writer, distanceCount, LZ_DISTANCE_COUNT_BITS);
+    for (size_t i = 0; i < literalCount; i++) {
+        bit_writer_put(writer, literalLengths[i], BLOCK_CODE_LENGTH_BITS);
+    }
+    for (size_t i = 0; i < distanceCount; i++) {
+        bit_writer_put(writer, distanceLengths[i], BLOCK_CODE_LENGTH_BITS);
+    }
+
+    literals = src;
+    for (size_t i = 0; i < sequences.count; i++) {
+        const LzSequence* sequence = &sequences.items[i];
+        for (uint32_t j = 0; j < sequence->literals; j++) {
+            Sequence seq = literalCodes[literals[j]];
+            bit_writer_put(writer, seq.value, seq.size);
+        }
+        literals += sequence->literals + sequence->length;
+        if (sequence->length == 0) {
+            continue;
+        }
+        put_value(writer, literalCodes + UINT8_COUNT, sequence->length - LZ_MIN_MATCH);
+        put_value(writer, distanceCodes, sequence->distance - 1);
+    }
+    bit_writer_finish(writer);
+    free(sequences.items);
+    return 0;
+}
+
+/*
+ * Blocks which would grow are stored
+ */
+static size_t bound_block(size_t size) {
+    return 1 + size;
+}
+
+static uint32_t read_value(BitReader* reader, uint16_t code) {
+    if (code < LZ_DIRECT_CODES) {
+        return code;
+    }
+    uint8_t extraBits = code / 2 - 1;
+    return ((uint32_t) (2 + (code & 1)) << extraBits) + bit_reader_read(reader, extraBits);
+}
+
+/*
+ * Copies a match. Earlier bytes of the match may be a part of it, so with a short
+ * distance bytes are copied one by one
+ */
+static void copy_match(uint8_t* dst, uint32_t distance, uint32_t length) {
+    const uint8_t* src = dst - distance;
+    if (distance >= sizeof(uint64_t)) {
+        for (; length >= sizeof(uint64_t); length -= sizeof(uint64_t)) {
+            memcpy(dst, src, sizeof(uint64_t));
+            dst += sizeof(uint64_t);
+            src += sizeof(uint64_t);
+        }
+    }
+    while (length-- > 0) {
+        *dst++ = *src++;
+    }
+}
+
+/*
+ * Unarchives a block written by encode_block()
+ */
+static int decode_block(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize, const Data* data) {
+    if (srcSize < 1) {
+        return FAILURE;
+    }
+    if (src[0] == LZ_BLOCK_STORED) {
+        if (srcSize - 1 != dstSize) {
+            return FAILURE;
+        }
+        memcpy(dst, src + 1, dstSize);
+        return 0;
+    }
+    if (src[0] != LZ_BLOCK_CODED) {
+        return FAILURE;
+    }
+
+    BitReader reader;
+    bit_reader_init_memory(&reader, src + 1, srcSize - 1);
+    size_t literalCount = bit_reader_read(&reader, LZ_LITERAL_COUNT_BITS);
+    size_t distanceCount = bit_reader_read(&reader, LZ_DISTANCE_COUNT_BITS);
+    BlockDecodeEntry literalTable[BLOCK_DECODE_TABLE_SIZE];
+    BlockDecodeEntry distanceTable[BLOCK_DECODE_TABLE_SIZE];
+    if (literalCount > LZ_LITERAL_CODES || distanceCount > LZ_DISTANCE_CODES ||
+        read_block_decode_table(&reader, literalCount, LZ_LITERAL_CODES, literalTable) == FAILURE ||
+        read_block_decode_table(&reader, distanceCount, LZ_DISTANCE_CODES, distanceTable) == FAILURE) {
+        return FAILURE;
+    }
+
+    size_t position = 0;
+    while (position < dstSize) {
+        BlockDecodeEntry entry = literalTable[bit_reader_peek(&reader, BLOCK_CODE_MAX_LENGTH)];
+        if (entry.length == 0) {
+            return FAILURE;
+        }
+        bit_reader_consume(&reader, entry.length);
+        if (entry.symbol < UINT8_COUNT) {
+            dst[position++] = entry.symbol;
+            continue;
+        }
+        uint32_t length = LZ_MIN_MATCH + read_value(&reader, entry.symbol - UINT8_COUNT);
+
+        entry = distanceTable[bit_reader_peek(&reader, BLOCK_CODE_MAX_LENGTH)];
+        if (entry.length == 0) {
+            return FAILURE;
+        }
+        bit_reader_consume(&reader, entry.length);
+        uint32_t distance = 1 + read_value(&reader, entry.symbol);
+        if (distance > position || length > dstSize - position) {
+            return FAILURE;
+        }
+        copy_match(dst + position, distance, length);
+        position += length;
+    }
+    return bit_reader_overrun(&reader) ? FAILURE : 0;
+}
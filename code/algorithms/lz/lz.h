@@ -0,0 +1,12 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdio.h>
+
+#include "../../common.h"
+#include "../../data.h"
+#include "../../blocks.h"
+
+extern const BlockCodec lzBlockCodec;
+
+#endif
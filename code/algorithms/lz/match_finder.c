@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "match_finder.h"
+
+static uint32_t hash(const MatchFinder* finder, size_t position) {
+    uint32_t word;
+    memcpy(&word, finder->src + position, sizeof(word));
+    return (word * 2654435761u) >> (32 - finder->hashBits);
+}
+
+/*
+ * Chains are as long as the window, or the whole block if it's smaller.
+ * Small blocks get a smaller head table, which is cleared for each block
+ */
+void match_finder_init(MatchFinder* finder, const uint8_t* src, size_t size) {
+    finder->src = src;
+    finder->size = size;
+    finder->hashBits = LZ_MAX_HASH_BITS;
+    while (finder->hashBits > BYTE_SIZE && ((size_t) 1 << (finder->hashBits - 1)) >= size) {
+        finder->hashBits--;
+    }
+    finder->head = calloc((size_t) 1 << finder->hashBits, sizeof(uint32_t));
+    finder->prev = malloc((size < LZ_WINDOW_SIZE ? size + 1 : LZ_WINDOW_SIZE) * sizeof(uint32_t));
+    finder->inserted = 0;
+}
+
+/*
+ * Adds positions up to **position** (excluding it) to the chains
+ */
+static void insert(MatchFinder* finder, size_t position) {
+    size_t last = finder->size < LZ_MIN_MATCH ? 0 : finder->size - LZ_MIN_MATCH + 1;
+    position = position < last ? position : last;
+    for (size_t i = finder->inserted; i < position; i++) {
+        uint32_t h = hash(finder, i);
+        finder->prev[i & (LZ_WINDOW_SIZE - 1)] = finder->head[h];
+        finder->head[h] = i + 1;
+    }
+    if (position > finder->inserted) {
+        finder->inserted = position;
+    }
+}
+
+/*
+ * Returns the number of equal bytes at a and b, up to **limit**
+ */
+static uint32_t common_length(const uint8_t* a, const uint8_t* b, uint32_t limit) {
+    uint32_t length = 0;
+    while (length + sizeof(uint64_t) <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a + length, sizeof(x));
+        memcpy(&y, b + length, sizeof(y));
+        if (x != y) {
+            return length + (__builtin_ctzll(x ^ y) >> 3);
+        }
+        length += sizeof(uint64_t);
+    }
+    while (length < limit && a[length] == b[length]) {
+        length++;
+    }
+    return length;
+}
+
+/*
+ * Rough worth of a match in 1/30 bits: a matched byte saves about 4.5 bits,
+ * and each doubling of the distance costs about one more bit
+ */
+int64_t match_score(uint32_t length, size_t distance) {
+    return 135 * (int64_t) length - 30 * (63 - __builtin_clzll(distance));
+}
+
+/*
+ * Finds the longest match (at least **minLength** bytes) of the bytes at **position**
+ * with earlier bytes of the window, walking the chain of its hash. A longer match
+ * replaces a nearer one only if it's worth more by match_score
+ */
+LzMatch match_finder_find(MatchFinder* finder, size_t position, const LzLevel* level, uint32_t minLength) {
+    LzMatch match = {0, 0};
+    size_t available = finder->size - position;
+    uint32_t limit = available < LZ_MAX_MATCH ? available : LZ_MAX_MATCH;
+    if (limit < minLength || limit < LZ_MIN_MATCH) {
+        return match;
+    }
+    insert(finder, position);
+
+    const uint8_t* current = finder->src + position;
+    uint32_t best = minLength - 1;
+    int64_t bestScore = INT64_MIN;
+    uint32_t candidate = finder->head[hash(finder, position)];
+    for (uint32_t chain = level->chainLength; candidate != 0 && chain > 0; chain--) {
+        size_t earlier = candidate - 1;
+        size_t distance = position - earlier;
+        if (distance > LZ_MAX_DISTANCE) {
+            break;
+        }
+        const uint8_t* bytes = finder->src + earlier;
+        /* The byte that would make the match longer than the best one is checked first */
+        if (bytes[best] == current[best]) {
+            uint32_t length = common_length(bytes, current, limit);
+            if (length > best && match_score(length, distance) > bestScore) {
+                best = length;
+                bestScore = match_score(length, distance);
+                match.length = length;
+                match.distance = distance;
+                if (length >= level->niceLength || length == limit) {
+                    break;
+                }
+            }
+        }
+        candidate = finder->prev[earlier & (LZ_WINDOW_SIZE - 1)];
+    }
+    return match;
+}
+
+void match_finder_free(MatchFinder* finder) {
+    free(finder->head);
+    free(finder->prev);
+    finder->head = NULL;
+    finder->prev = NULL;
+}
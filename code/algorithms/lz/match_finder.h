@@ -0,0 +1,48 @@
+#ifndef LZ_MATCH_FINDER_H
+#define LZ_MATCH_FINDER_H
+
+#include "../../common.h"
+
+/* Matches are looked for this far back (in bytes) */
+#define LZ_WINDOW_BITS 18
+#define LZ_WINDOW_SIZE ((size_t) 1 << LZ_WINDOW_BITS)
+#define LZ_MAX_DISTANCE (LZ_WINDOW_SIZE - 1)
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_MATCH (LZ_MIN_MATCH + UINT16_MAX)
+
+#define LZ_MAX_HASH_BITS 16
+
+/* How hard matches are searched for at a compression level */
+typedef struct {
+    uint32_t chainLength; /* Max number of earlier positions compared with the current one */
+    uint32_t niceLength;  /* A match this long is taken without looking further */
+    bool     lazy;        /* A match is dropped for a longer one starting at the next byte */
+} LzLevel;
+
+typedef struct {
+    uint32_t length;      /* 0 if no match was found */
+    uint32_t distance;
+} LzMatch;
+
+/**
+ * Hash chains. Positions are hashed by their first LZ_MIN_MATCH bytes:
+ * **head** holds the last position with each hash, and **prev** links every
+ * position of the window to the previous one with the same hash. Positions
+ * are stored plus one, so 0 ends a chain
+ */
+typedef struct {
+    const uint8_t* src;
+    size_t         size;
+    uint32_t*      head;
+    uint32_t*      prev;
+    uint8_t        hashBits;
+    size_t         inserted; /* Positions below are in the chains */
+} MatchFinder;
+
+void match_finder_init(MatchFinder* finder, const uint8_t* src, size_t size);
+int64_t match_score(uint32_t length, size_t distance);
+LzMatch match_finder_find(MatchFinder* finder, size_t position, const LzLevel* level, uint32_t minLength);
+void match_finder_free(MatchFinder* finder);
+
+#endif
@@ -0,0 +1,338 @@
+#include <stdlib.h>
+
+#include "range_coder.h"
+#include "../../archiver.h"
+#include "../../bitio.h"
+
+/*
+ * Archive heading: the version in the high nibble of the first byte and the context
+ * order in the low one, then the signature. The range coded stream follows. Input is
+ * coded in pieces of up to BLOCK_SIZE bytes: a set flag bit, the size of the piece - 1
+ * in PIECE_SIZE_BITS bits, then its bytes. A cleared flag ends the archive. The model
+ * is kept from piece to piece, so the archive is made in a single pass like
+ * adaptive-huffman, without knowing the size of the input
+ */
+#define RANGE_CODER_VERSION 1
+#define RANGE_CODER_VERSION_SHIFT 4
+#define ORDER_MASK 0x0f
+#define PIECE_SIZE_BITS 16
+
+/* The range is kept at least TOP_VALUE wide, bytes are shifted out from the top */
+#define TOP_VALUE (1u << 24)
+#define LOW_SHIFT 24
+#define FLUSH_BYTES 5
+
+/*
+ * Every byte starts with frequency 1 in every context, so bytes seen for the first
+ * time need no escape. Coding a byte adds FREQUENCY_STEP to its frequency; when the
+ * total goes over MAX_TOTAL, all frequencies are halved, so recent bytes weigh more
+ * and the model follows changes of the data
+ */
+#define FREQUENCY_STEP 32
+#define MAX_TOTAL (1 << 14)
+
+/*
+ * Byte frequencies after one previous byte (order 1), or after any byte (order 0).
+ * Bytes are kept sorted by frequency, so frequent bytes are found in a few steps
+ */
+typedef struct {
+    uint32_t total;
+    uint32_t reciprocal;               /* UINT32_MAX / total, saves a division per byte */
+    uint16_t frequencies[UINT8_COUNT]; /* By rank */
+    uint8_t  bytes[UINT8_COUNT];       /* By rank */
+    uint8_t  ranks[UINT8_COUNT];       /* By byte */
+} Context;
+
+typedef struct {
+    Context* contexts;
+    uint8_t  contextMask; /* Bits of the previous byte which select the context */
+    uint8_t  previous;
+} ContextModel;
+
+typedef struct {
+    uint64_t  low;     /* Bit 32 is the carry into the cached byte */
+    uint32_t  range;
+    uint8_t   cache;   /* The last byte shifted out, it may still get a carry */
+    uint64_t  pending; /* Number of cached bytes: the cached one and 0xff bytes after it */
+    BitWriter* writer;
+} RangeEncoder;
+
+typedef struct {
+    uint32_t   code;   /* Offset of the coded value from the low end of the range */
+    uint32_t   range;
+    BitReader* reader;
+} RangeDecoder;
+
+static void initialize_model(ContextModel* model, int order) {
+    size_t count = order == 0 ? 1 : UINT8_COUNT;
+    model->contexts = malloc(count * sizeof(Context));
+    model->contextMask = order == 0 ? 0 : UINT8_MAX;
+    model->previous = 0;
+    for (size_t i = 0; i < count; i++) {
+        Context* context = &model->contexts[i];
+        context->total = UINT8_COUNT;
+        context->reciprocal = UINT32_MAX / UINT8_COUNT;
+        for (uint16_t j = 0; j < UINT8_COUNT; j++) {
+            context->frequencies[j] = 1;
+            context->bytes[j] = j;
+            context->ranks[j] = j;
+        }
+    }
+}
+
+static void free_model(ContextModel* model) {
+    free(model->contexts);
+    model->contexts = NULL;
+}
+
+static inline Context* current_context(const ContextModel* model) {
+    return &model->contexts[model->previous & model->contextMask];
+}
+
+/*
+ * Counts the byte of **rank** and moves it up past the bytes which are now less frequent
+ */
+static inline void update_context(Context* context, uint32_t rank) {
+    context->frequencies[rank] += FREQUENCY_STEP;
+    context->total += FREQUENCY_STEP;
+    while (rank > 0 && context->frequencies[rank] > context->frequencies[rank - 1]) {
+        uint16_t frequency = context->frequencies[rank];
+        context->frequencies[rank] = context->frequencies[rank - 1];
+        context->frequencies[rank - 1] = frequency;
+
+        uint8_t byte = context->bytes[rank];
+        uint8_t other = context->bytes[rank - 1];
+        context->bytes[rank] = other;
+        context->bytes[rank - 1] = byte;
+        context->ranks[other] = rank;
+        context->ranks[byte] = rank - 1;
+        rank--;
+    }
+    if (context->total > MAX_TOTAL) {
+        /* Halving keeps the order, and every byte keeps a nonzero frequency */
+        context->total = 0;
+        for (uint16_t i = 0; i < UINT8_COUNT; i++) {
+            context->frequencies[i] = (context->frequencies[i] + 1) >> 1;
+            context->total += context->frequencies[i];
+        }
+    }
+    /* Divided here, off the path from one coded byte to the next */
+    context->reciprocal = UINT32_MAX / context->total;
+}
+
+/*
+ * Part of **range** for a frequency of 1. It's at most range / total,
+ * so the frequencies of the context always fit into the range
+ */
+static inline uint32_t range_step(const Context* context, uint32_t range) {
+    return ((uint64_t) range * context->reciprocal) >> 32;
+}
+
+static void range_encoder_init(RangeEncoder* encoder, BitWriter* writer) {
+    encoder->low = 0;
+    encoder->range = UINT32_MAX;
+    encoder->cache = 0;
+    encoder->pending = 1;
+    encoder->writer = writer;
+}
+
+/*
+ * Moves the top byte of low to the output. A byte is held back while a carry
+ * from later bytes can still change it: 0xff bytes are only counted until
+ * a byte which stops the carry comes
+ */
+static void shift_low(RangeEncoder* encoder) {
+    if ((uint32_t) encoder->low < (UINT32_C(0xff) << LOW_SHIFT) || encoder->low > UINT32_MAX) {
+        uint8_t carry = encoder->low >> 32;
+        bit_writer_put(encoder->writer, (uint8_t) (encoder->cache + carry), BYTE_SIZE);
+        for (; encoder->pending > 1; encoder->pending--) {
+            bit_writer_put(encoder->writer, (uint8_t) (UINT8_MAX + carry), BYTE_SIZE);
+        }
+        encoder->pending = 0;
+        encoder->cache = (uint8_t) (encoder->low >> LOW_SHIFT);
+    }
+    encoder->pending++;
+    encoder->low = (encoder->low & (TOP_VALUE - 1)) << BYTE_SIZE;
+}
+
+static inline void normalize_encoder(RangeEncoder* encoder) {
+    while (encoder->range < TOP_VALUE) {
+        encoder->range <<= BYTE_SIZE;
+        shift_low(encoder);
+    }
+}
+
+/*
+ * Codes **count** (1-16) bits of value with equal probabilities
+ */
+static void encode_bits(RangeEncoder* encoder, uint32_t value, uint8_t count) {
+    encoder->range >>= count;
+    encoder->low += (uint64_t) value * encoder->range;
+    normalize_encoder(encoder);
+}
+
+static inline void encode_byte(ContextModel* model, RangeEncoder* encoder, uint8_t byte) {
+    Context* context = current_context(model);
+    uint32_t rank = context->ranks[byte];
+    uint32_t cumulative = 0;
+    for (uint32_t i = 0; i < rank; i++) {
+        cumulative += context->frequencies[i];
+    }
+    uint32_t step = range_step(context, encoder->range);
+    encoder->low += (uint64_t) cumulative * step;
+    encoder->range = context->frequencies[rank] * step;
+    normalize_encoder(encoder);
+    update_context(context, rank);
+    model->previous = byte;
+}
+
+static void range_encoder_finish(RangeEncoder* encoder) {
+    for (int i = 0; i < FLUSH_BYTES; i++) {
+        shift_low(encoder);
+    }
+}
+
+static void encode_piece(ContextModel* model, RangeEncoder* encoder, const uint8_t* src, size_t size) {
+    encode_bits(encoder, 1, 1);
+    encode_bits(encoder, size - 1, PIECE_SIZE_BITS);
+    for (size_t i = 0; i < size; i++) {
+        encode_byte(model, encoder, src[i]);
+    }
+}
+
+int range_coder_archive(Data* data) {
+    uint8_t heading[] = {RANGE_CODER_VERSION << RANGE_CODER_VERSION_SHIFT | data->order, SIG_RANGE_CODER};
+    fwrite(heading, sizeof(uint8_t), sizeof(heading), fileOut);
+
+    ContextModel model;
+    RangeEncoder encoder;
+    BitWriter writer;
+    initialize_model(&model, data->order);
+    bit_writer_init(&writer, fileOut);
+    range_encoder_init(&encoder, &writer);
+    if (mappedIn.data != NULL) {
+        for (size_t offset = 0; offset < mappedIn.size; offset += BLOCK_SIZE) {
+            size_t size = mappedIn.size - offset < BLOCK_SIZE ? mappedIn.size - offset : BLOCK_SIZE;
+            encode_piece(&model, &encoder, mappedIn.data + offset, size);
+        }
+    } else {
+        size_t size;
+        while ((size = update_buffer()) > 0) {
+            encode_piece(&model, &encoder, bufferIn, size);
+        }
+    }
+    encode_bits(&encoder, 0, 1);
+    range_encoder_finish(&encoder);
+    bit_writer_finish(&writer);
+    bit_writer_free(&writer);
+    free_model(&model);
+    return 0;
+}
+
+static void range_decoder_init(RangeDecoder* decoder, BitReader* reader) {
+    decoder->code = 0;
+    decoder->range = UINT32_MAX;
+    decoder->reader = reader;
+    /* The first byte is the initial cache of the encoder */
+    for (int i = 0; i < FLUSH_BYTES; i++) {
+        decoder->code = (decoder->code << BYTE_SIZE) | bit_reader_read(reader, BYTE_SIZE);
+    }
+}
+
+static inline void normalize_decoder(RangeDecoder* decoder) {
+    while (decoder->range < TOP_VALUE) {
+        decoder->range <<= BYTE_SIZE;
+        decoder->code = (decoder->code << BYTE_SIZE) | bit_reader_read(decoder->reader, BYTE_SIZE);
+    }
+}
+
+/*
+ * Returns the value of **count** bits coded by encode_bits, or FAILURE
+ * if the code is out of the range (the archive is corrupted)
+ */
+static int decode_bits(RangeDecoder* decoder, uint8_t count) {
+    decoder->range >>= count;
+    uint32_t value = decoder->code / decoder->range;
+    if (value >> count != 0) {
+        return FAILURE;
+    }
+    decoder->code -= value * decoder->range;
+    normalize_decoder(decoder);
+    return value;
+}
+
+/*
+ * Returns the next byte, or FAILURE if the code is out of the range
+ */
+static inline int decode_byte(ContextModel* model, RangeDecoder* decoder) {
+    Context* context = current_context(model);
+    uint32_t step = range_step(context, decoder->range);
+    if (decoder->code >= step * context->total) {
+        return FAILURE;
+    }
+    uint32_t rank = 0;
+    uint32_t low = 0;
+    uint32_t high = context->frequencies[0] * step;
+    while (decoder->code >= high) {
+        low = high;
+        rank++;
+        high += context->frequencies[rank] * step;
+    }
+    decoder->code -= low;
+    decoder->range = high - low;
+    normalize_decoder(decoder);
+
+    uint8_t byte = context->bytes[rank];
+    update_context(context, rank);
+    model->previous = byte;
+    return byte;
+}
+
+int range_coder_unarchive(Data* data) {
+    uint8_t heading[2] = {0};
+    fread(heading, sizeof(uint8_t), sizeof(heading), fileIn);
+    int order = heading[0] & ORDER_MASK;
+    if (heading[0] >> RANGE_CODER_VERSION_SHIFT != RANGE_CODER_VERSION ||
+        heading[1] != SIG_RANGE_CODER || order < MIN_ORDER || order > MAX_ORDER) {
+        archiveError("invalid archive");
+        return FAILURE;
+    }
+
+    BitReader reader;
+    if (mappedIn.data != NULL) {
+        bit_reader_init_memory(&reader, mappedIn.data + sizeof(heading), mappedIn.size - sizeof(heading));
+    } else {
+        bit_reader_init(&reader, fileIn);
+    }
+
+    ContextModel model;
+    RangeDecoder decoder;
+    initialize_model(&model, order);
+    range_decoder_init(&decoder, &reader);
+
+    int flag;
+    int success = 0;
+    while ((flag = decode_bits(&decoder, 1)) == 1) {
+        int size = decode_bits(&decoder, PIECE_SIZE_BITS);
+        for (int i = 0; i <= size; i++) {
+            int c = decode_byte(&model, &decoder);
+            if (c == FAILURE) {
+                size = FAILURE;
+                break;
+            }
+            output_byte(c);
+        }
+        if (size == FAILURE || bit_reader_overrun(&reader)) {
+            flag = FAILURE;
+            break;
+        }
+    }
+    if (flag == FAILURE || bit_reader_overrun(&reader)) {
+        archiveError(bit_reader_overrun(&reader) ? "unexpected end of archive" : "invalid archive");
+        success = FAILURE;
+    }
+    flush_buffer();
+    bit_reader_free(&reader);
+    free_model(&model);
+    return success;
+}
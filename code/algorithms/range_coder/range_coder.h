@@ -0,0 +1,12 @@
+#ifndef RANGE_CODER_H
+#define RANGE_CODER_H
+
+#include <stdio.h>
+
+#include "../../common.h"
+#include "../../data.h"
+
+int range_coder_archive(Data* data);
+int range_coder_unarchive(Data* data);
+
+#endif
@@ -3,23 +3,37 @@
 #include <stdlib.h>
 
 #include "archiver.h"
+#include "blocks.h"
 #include "algorithms/huffman/huffman.h"
 #include "algorithms/adaptive_huffman/adaptive_huffman.h"
+#include "algorithms/lz/lz.h"
+#include "algorithms/fast/fast.h"
+#include "algorithms/ans/ans.h"
+#include "algorithms/range_coder/range_coder.h"
+#include "algorithms/bwt/bwt.h"
 
 typedef int (*ArchiveFn)(Data* data);
 
 typedef struct {
     ArchiveFn archiveFunction;
     ArchiveFn unarchiveFunction;
+    ArchiveFn extractFunction; /* Unarchives data->rangeLength bytes from data->rangeOffset, may be NULL */
+    const BlockCodec* blockCodec; /* Used by the generic block functions in place of NULL functions */
 } Operations;
 
 int archiveError(const char* message, ...) {
     va_list args;
     va_start (args, message);
 
-    printf("Archive error: ");
-    vprintf (message, args);
-    printf(".\n");
+    /*
+     * Keep the message in one piece when several files are archived at once.
+     * It goes to stderr, as the standard output may be the archived data
+     */
+    flockfile(stderr);
+    fprintf(stderr, "Archive error: ");
+    vfprintf(stderr, message, args);
+    fprintf(stderr, ".\n");
+    funlockfile(stderr);
 
     va_end (args);
 }
@@ -38,17 +52,22 @@ static long file_size(char filename[]) {
 }
 
 static int init(Data* data) {
-    data->fileInSize = file_size(data->fileIn);
-    if (data->fileInSize == FAILURE) {
-        return FAILURE;
+    if (is_std_stream(data->fileIn)) {
+        fileIn = stdin;
+        data->fileInSize = FAILURE; /* Unknown */
+    } else {
+        data->fileInSize = file_size(data->fileIn);
+        if (data->fileInSize == FAILURE) {
+            return FAILURE;
+        }
+        fileIn = fopen(data->fileIn, "rb");
     }
-
-    fileIn = fopen(data->fileIn, "rb");
     if (fileIn == NULL) {
         archiveError("can't open file: %s", data->fileIn);
         return FAILURE;
     }
-    fileOut = fopen(data->fileOut, "wb");
+    map_input();
+    fileOut = is_std_stream(data->fileOut) ? stdout : fopen(data->fileOut, "wb");
     if (fileOut == NULL) {
         archiveError("can't open file: %s", data->fileOut);
         return FAILURE;
@@ -57,15 +76,29 @@ static int init(Data* data) {
 }
 
 static void post(Data* data) {
-    fclose(fileIn);
+    unmap_input();
+    if (fileIn != stdin) {
+        fclose(fileIn);
+    }
+    if (fileOut == stdout) {
+        fflush(fileOut);
+        return;
+    }
     fclose(fileOut);
     data->fileOutSize = file_size(data->fileOut);
-    data->efficiency = ((double) data->fileOutSize / data->fileInSize) * 100;
+    if (data->fileInSize != FAILURE) {
+        data->efficiency = ((double) data->fileOutSize / data->fileInSize) * 100;
+    }
 }
 
 Operations operations[] = {
-    [ALG_HUFFMAN]          = {huffman_archive,          huffman_unarchive},
-    [ALG_ADAPTIVE_HUFFMAN] = {adaptive_huffman_archive, adaptive_huffman_unarchive},
+    [ALG_HUFFMAN]          = {huffman_archive,          huffman_unarchive,          huffman_extract},
+    [ALG_ADAPTIVE_HUFFMAN] = {adaptive_huffman_archive, adaptive_huffman_unarchive, NULL},
+    [ALG_LZ]               = {.blockCodec = &lzBlockCodec},
+    [ALG_FAST]             = {.blockCodec = &fastBlockCodec},
+    [ALG_ANS]              = {.blockCodec = &ansBlockCodec},
+    [ALG_RANGE_CODER]      = {range_coder_archive,      range_coder_unarchive,      NULL},
+    [ALG_BWT]              = {bwt_archive, NULL, NULL, &bwtBlockCodec},
 };
 
 int archive(Data* data) {
@@ -73,10 +106,15 @@ int archive(Data* data) {
         return FAILURE;
     }
 
-    printf("Compressing the file: %s\n\n", data->fileIn);
-    printf("Saving to file: %s\n\n", data->fileOut);
+    /* Batch mode prints a line per file instead */
+    if (fileOut != stdout && data->files == NULL) {
+        printf("Compressing the file: %s\n\n", data->fileIn);
+        printf("Saving to file: %s\n\n", data->fileOut);
+    }
 
-    int success = operations[data->algorithmType].archiveFunction(data);
+    const Operations* operation = &operations[data->algorithmType];
+    int success = operation->archiveFunction != NULL ? operation->archiveFunction(data)
+                                                     : blocks_codec_archive(data, operation->blockCodec);
     
     post(data);
     return success;
@@ -87,10 +125,40 @@ int unarchive(Data* data) {
         return FAILURE;
     }
 
-    printf("Decompressing the file: %s\n\n", data->fileIn);
-    printf("Saving to file: %s\n\n", data->fileOut);
+    if (fileOut != stdout && data->files == NULL) {
+        printf("Decompressing the file: %s\n\n", data->fileIn);
+        printf("Saving to file: %s\n\n", data->fileOut);
+    }
+
+    const Operations* operation = &operations[data->algorithmType];
+    int success = operation->unarchiveFunction != NULL ? operation->unarchiveFunction(data)
+                                                       : blocks_codec_unarchive(data, operation->blockCodec);
+
+    post(data);
+    return success;
+}
+
+/*
+ * Unarchives a range of the original file (data->rangeOffset, data->rangeLength)
+ */
+int extract(Data* data) {
+    const Operations* operation = &operations[data->algorithmType];
+    if (operation->extractFunction == NULL && operation->blockCodec == NULL) {
+        archiveError("the algorithm doesn't support range unarchiving");
+        return FAILURE;
+    }
+    if (init(data) != 0) {
+        return FAILURE;
+    }
+
+    if (fileOut != stdout) {
+        printf("Decompressing bytes %llu-%llu of the file: %s\n\n", (unsigned long long) data->rangeOffset,
+               (unsigned long long) (data->rangeOffset + data->rangeLength - 1), data->fileIn);
+        printf("Saving to file: %s\n\n", data->fileOut);
+    }
 
-    int success = operations[data->algorithmType].unarchiveFunction(data);
+    int success = operation->extractFunction != NULL ? operation->extractFunction(data)
+                                                     : blocks_codec_extract(data, operation->blockCodec);
 
     post(data);
     return success;
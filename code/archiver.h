@@ -6,6 +6,7 @@
 
 int archive(Data* data);
 int unarchive(Data* data);
+int extract(Data* data);
 int archiveError(const char* message, ...);
 
 #endif
\ No newline at end of file
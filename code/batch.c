@@ -0,0 +1,149 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "archiver.h"
+#include "parallel.h"
+#include "parser.h"
+#include "stats.h"
+
+typedef struct {
+    char** paths;
+    size_t count;
+    size_t capacity;
+} FileList;
+
+typedef struct {
+    const Data* data;
+    FileList*   files;
+    Data*       results; /* Options and statistics of each file */
+    int*        statuses;
+} BatchJob;
+
+static void add_file(FileList* files, char* path) {
+    if (files->count == files->capacity) {
+        files->capacity = files->capacity == 0 ? 64 : files->capacity * 2;
+        files->paths = realloc(files->paths, files->capacity * sizeof(char*));
+    }
+    files->paths[files->count++] = path;
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+static bool is_archive_name(const char* path) {
+    size_t length = strlen(path);
+    return length >= 4 && strcmp(path + length - 4, ".par") == 0;
+}
+
+/*
+ * Adds the files of a directory and its subdirectories: archives when unarchiving,
+ * other files when archiving. Files are added in name order
+ */
+static int add_directory(FileList* files, const char* path, bool isArchiving) {
+    DIR* directory = opendir(path);
+    if (directory == NULL) {
+        archiveError("can't open directory: %s", path);
+        return FAILURE;
+    }
+    FileList entries = {NULL, 0, 0};
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char* entryPath = malloc(strlen(path) + strlen(entry->d_name) + 2);
+        sprintf(entryPath, "%s/%s", path, entry->d_name);
+        add_file(&entries, entryPath);
+    }
+    closedir(directory);
+    qsort(entries.paths, entries.count, sizeof(char*), compare_paths);
+
+    int success = 0;
+    for (size_t i = 0; i < entries.count; i++) {
+        struct stat info;
+        if (stat(entries.paths[i], &info) != 0) {
+            free(entries.paths[i]);
+        } else if (S_ISDIR(info.st_mode)) {
+            success |= add_directory(files, entries.paths[i], isArchiving);
+            free(entries.paths[i]);
+        } else if (S_ISREG(info.st_mode) && is_archive_name(entries.paths[i]) != isArchiving) {
+            add_file(files, entries.paths[i]);
+        } else {
+            free(entries.paths[i]);
+        }
+    }
+    free(entries.paths);
+    return success;
+}
+
+static void process_file(void* context, size_t i) {
+    BatchJob* job = context;
+    Data* data = &job->results[i];
+    *data = *job->data;
+    data->fileIn = job->files->paths[i];
+    data->fileOut = determine_out_file(data);
+    job->statuses[i] = data->isArchiving ? archive(data) : unarchive(data);
+}
+
+/*
+ * Archives or unarchives every file of data->files (directories are walked
+ * recursively) on data->jobs threads. Output file names are made as for a
+ * single input file. Prints a line per file; the total sizes are saved to data
+ */
+int batch(Data* data) {
+    FileList files = {NULL, 0, 0};
+    int success = 0;
+    for (size_t i = 0; i < data->filesCount; i++) {
+        struct stat info;
+        if (stat(data->files[i], &info) != 0) {
+            archiveError("can't open file: %s", data->files[i]);
+            success = FAILURE;
+        } else if (S_ISDIR(info.st_mode)) {
+            success |= add_directory(&files, data->files[i], data->isArchiving);
+        } else {
+            add_file(&files, strdup(data->files[i]));
+        }
+    }
+
+    if (success != 0) {
+        for (size_t i = 0; i < files.count; i++) {
+            free(files.paths[i]);
+        }
+        free(files.paths);
+        return FAILURE;
+    }
+
+    Data* results = malloc(files.count * sizeof(Data));
+    int* statuses = malloc(files.count * sizeof(int));
+    BatchJob job = {data, &files, results, statuses};
+    parallel_for(files.count, data->jobs, process_file, &job);
+
+    size_t failed = 0;
+    data->fileInSize = 0;
+    data->fileOutSize = 0;
+    for (size_t i = 0; i < files.count; i++) {
+        output_file_stats(&results[i], statuses[i]);
+        if (statuses[i] != 0) {
+            failed++;
+        } else {
+            data->fileInSize += results[i].fileInSize;
+            data->fileOutSize += results[i].fileOutSize;
+        }
+        free(results[i].fileOut);
+        free(files.paths[i]);
+    }
+    printf("\n%zu files, %zu failed\n\n", files.count, failed);
+    if (data->fileInSize > 0) {
+        data->efficiency = ((double) data->fileOutSize / data->fileInSize) * 100;
+    }
+
+    free(files.paths);
+    free(results);
+    free(statuses);
+    return failed == 0 ? 0 : FAILURE;
+}
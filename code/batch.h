@@ -0,0 +1,9 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "common.h"
+#include "data.h"
+
+int batch(Data* data);
+
+#endif
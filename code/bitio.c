@@ -0,0 +1,150 @@
+#include <stdlib.h>
+
+#include "bitio.h"
+
+void bit_writer_init(BitWriter* writer, FILE* file) {
+    writer->accumulator = 0;
+    writer->count = 0;
+    writer->buffer = malloc(BLOCK_SIZE);
+    writer->size = 0;
+    writer->capacity = BLOCK_SIZE;
+    writer->file = file;
+}
+
+/*
+ * Drops all written bits, keeping the buffer
+ */
+void bit_writer_reset(BitWriter* writer) {
+    writer->accumulator = 0;
+    writer->count = 0;
+    writer->size = 0;
+}
+
+/*
+ * Makes room in the buffer: writes it to the file, or grows it for in-memory output
+ */
+void bit_writer_flush(BitWriter* writer) {
+    if (writer->file != NULL) {
+        fwrite(writer->buffer, sizeof(uint8_t), writer->size, writer->file);
+        writer->size = 0;
+        return;
+    }
+    writer->capacity *= 2;
+    writer->buffer = realloc(writer->buffer, writer->capacity);
+}
+
+/*
+ * Outputs the pending bits, padding the last byte with zero bits, and writes
+ * the buffer to the file (if there's one). Returns the number of padding bits
+ */
+uint8_t bit_writer_finish(BitWriter* writer) {
+    uint8_t extraBits = (BYTE_SIZE - writer->count % BYTE_SIZE) % BYTE_SIZE;
+    writer->accumulator <<= extraBits;
+    writer->count += extraBits;
+
+    while (writer->count > 0) {
+        if (writer->size == writer->capacity) {
+            bit_writer_flush(writer);
+        }
+        writer->count -= BYTE_SIZE;
+        writer->buffer[writer->size++] = (writer->accumulator >> writer->count) & 0xff;
+    }
+    writer->accumulator = 0;
+    if (writer->file != NULL) {
+        bit_writer_flush(writer);
+    }
+    return extraBits;
+}
+
+/*
+ * Appends **size** bytes as they are, after padding the pending bits to a whole byte
+ */
+void bit_writer_put_bytes(BitWriter* writer, const uint8_t* bytes, size_t size) {
+    bit_writer_finish(writer);
+    while (size > 0) {
+        if (writer->size == writer->capacity) {
+            bit_writer_flush(writer);
+        }
+        size_t chunk = writer->capacity - writer->size < size ? writer->capacity - writer->size : size;
+        memcpy(writer->buffer + writer->size, bytes, chunk);
+        writer->size += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+/*
+ * Pads the pending bits to a whole byte and makes room for **size** more bytes
+ * of an in-memory writer. Returns where they go; the caller writes them and
+ * adds their number to writer->size
+ */
+uint8_t* bit_writer_reserve(BitWriter* writer, size_t size) {
+    bit_writer_finish(writer);
+    while (writer->capacity - writer->size < size) {
+        bit_writer_flush(writer);
+    }
+    return writer->buffer + writer->size;
+}
+
+void bit_writer_free(BitWriter* writer) {
+    free(writer->buffer);
+    writer->buffer = NULL;
+    writer->size = 0;
+    writer->capacity = 0;
+}
+
+void bit_reader_init(BitReader* reader, FILE* file) {
+    reader->buffer = malloc(BLOCK_SIZE);
+    reader->window = 0;
+    reader->count = 0;
+    reader->data = reader->buffer;
+    reader->size = 0;
+    reader->index = 0;
+    reader->file = file;
+    reader->overrun = false;
+}
+
+void bit_reader_init_memory(BitReader* reader, const uint8_t* data, size_t size) {
+    reader->buffer = NULL;
+    reader->window = 0;
+    reader->count = 0;
+    reader->data = data;
+    reader->size = size;
+    reader->index = 0;
+    reader->file = NULL;
+    reader->overrun = false;
+}
+
+/*
+ * Refills the window byte by byte, near the end of data
+ */
+void bit_reader_refill_slow(BitReader* reader) {
+    if (reader->count < 0) { /* Zero bits past the end of data were consumed */
+        reader->overrun = true;
+        reader->count = 0;
+    }
+    while (reader->count <= 56) {
+        if (reader->index == reader->size) {
+            if (reader->file == NULL) {
+                return;
+            }
+            reader->size = fread(reader->buffer, sizeof(uint8_t), BLOCK_SIZE, reader->file);
+            reader->index = 0;
+            if (reader->size == 0) { /* End of the file */
+                return;
+            }
+            if (reader->size >= sizeof(uint64_t)) {
+                bit_reader_refill(reader);
+                return;
+            }
+            continue;
+        }
+        reader->window |= (uint64_t) reader->data[reader->index++] << (56 - reader->count);
+        reader->count += BYTE_SIZE;
+    }
+}
+
+void bit_reader_free(BitReader* reader) {
+    free(reader->buffer);
+    reader->buffer = NULL;
+}
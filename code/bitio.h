@@ -0,0 +1,118 @@
+#ifndef BITIO_H
+#define BITIO_H
+
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+
+/**
+ * Bit output with a 64-bit accumulator. Bits are written most significant
+ * bit first. Whole 32-bit words are moved from the accumulator to the byte
+ * buffer, and the buffer is written to **file** when it's full. Without a file,
+ * the buffer grows, and the writer keeps the whole output in memory
+ */
+typedef struct {
+    uint64_t accumulator; /* Pending bits, the last written bit is the least significant one */
+    uint8_t  count;       /* Number of pending bits, less than 32 between calls */
+    uint8_t* buffer;
+    size_t   size;        /* Number of bytes in buffer */
+    size_t   capacity;
+    FILE*    file;
+} BitWriter;
+
+/**
+ * Bit input with a 64-bit window. The next bit of the stream is the most
+ * significant bit of the window. Reads from a memory block, which is refilled
+ * from **file** if there's one. Past the end of data, zero bits are read
+ */
+typedef struct {
+    uint64_t       window;
+    int            count;  /* Number of stream bits in window */
+    const uint8_t* data;
+    size_t         size;   /* Number of bytes in data */
+    size_t         index;  /* Index of the next byte of data to be moved to window */
+    FILE*          file;
+    uint8_t*       buffer; /* Owned memory for file input */
+    bool           overrun; /* Zero bits past the end of data were read */
+} BitReader;
+
+void bit_writer_init(BitWriter* writer, FILE* file);
+void bit_writer_reset(BitWriter* writer);
+void bit_writer_flush(BitWriter* writer);
+uint8_t bit_writer_finish(BitWriter* writer);
+void bit_writer_put_bytes(BitWriter* writer, const uint8_t* bytes, size_t size);
+uint8_t* bit_writer_reserve(BitWriter* writer, size_t size);
+void bit_writer_free(BitWriter* writer);
+
+void bit_reader_init(BitReader* reader, FILE* file);
+void bit_reader_init_memory(BitReader* reader, const uint8_t* data, size_t size);
+void bit_reader_refill_slow(BitReader* reader);
+void bit_reader_free(BitReader* reader);
+
+static inline uint64_t load_be64(const uint8_t* bytes) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return __builtin_bswap64(word);
+}
+
+/*
+ * Appends **size** (0-32) low bits of **value**. Higher bits of value must be zero
+ */
+static inline void bit_writer_put(BitWriter* writer, uint32_t value, uint8_t size) {
+    writer->accumulator = (writer->accumulator << size) | value;
+    writer->count += size;
+    if (writer->count >= 32) {
+        if (writer->size + sizeof(uint32_t) > writer->capacity) {
+            bit_writer_flush(writer);
+        }
+        writer->count -= 32;
+        uint32_t word = __builtin_bswap32((uint32_t) (writer->accumulator >> writer->count));
+        memcpy(writer->buffer + writer->size, &word, sizeof(word));
+        writer->size += sizeof(word);
+    }
+}
+
+/*
+ * Makes sure that the window holds at least 56 bits (unless data has ended)
+ */
+static inline void bit_reader_refill(BitReader* reader) {
+    if (reader->index + sizeof(uint64_t) <= reader->size) {
+        /* Fast path: take as many whole bytes as fit into the window at once */
+        reader->window |= load_be64(reader->data + reader->index) >> reader->count;
+        reader->index += (63 - reader->count) >> 3;
+        reader->count |= 56;
+        return;
+    }
+    bit_reader_refill_slow(reader);
+}
+
+/*
+ * Returns the next **size** (1-56) bits without consuming them
+ */
+static inline uint64_t bit_reader_peek(BitReader* reader, uint8_t size) {
+    if (reader->count < size) {
+        bit_reader_refill(reader);
+    }
+    return reader->window >> (64 - size);
+}
+
+static inline void bit_reader_consume(BitReader* reader, uint8_t size) {
+    reader->window <<= size;
+    reader->count -= size;
+}
+
+static inline uint64_t bit_reader_read(BitReader* reader, uint8_t size) {
+    uint64_t value = bit_reader_peek(reader, size);
+    bit_reader_consume(reader, size);
+    return value;
+}
+
+/*
+ * Returns true if more bits were read than there are in data
+ */
+static inline bool bit_reader_overrun(const BitReader* reader) {
+    return reader->overrun || reader->count < 0;
+}
+
+#endif
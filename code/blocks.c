@@ -0,0 +1,957 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "blocks.h"
+#include "archiver.h"
+#include "parallel.h"
+
+#define ARCHIVE_HEADER_SIZE 2 /* Version and signature */
+#define BLOCK_HEADER_SIZE (2 * sizeof(uint32_t))
+#define INDEX_ENTRY_SIZE (sizeof(uint64_t) + 2 * sizeof(uint32_t))
+
+typedef struct {
+    const uint8_t* input;
+    uint8_t*       buffer;    /* Memory for input, when the input file isn't mapped */
+    size_t         inputSize;
+    BitWriter      output;
+    BlockStats     stats;
+    int            status;
+} Block;
+
+/*
+ * Appends an index entry, growing the index when needed
+ */
+static void add_index_entry(BlockIndex* index, size_t* capacity, BlockIndexEntry entry) {
+    if (index->count == *capacity) {
+        *capacity = *capacity == 0 ? 64 : *capacity * 2;
+        index->entries = realloc(index->entries, *capacity * sizeof(BlockIndexEntry));
+    }
+    index->entries[index->count++] = entry;
+}
+
+static void write_index(const BlockIndex* index, FILE* file) {
+    for (size_t i = 0; i < index->count; i++) {
+        write_uint64(index->entries[i].offset, file);
+        write_uint32(index->entries[i].archivedSize, file);
+        write_uint32(index->entries[i].originalSize, file);
+    }
+    write_uint64(index->count, file);
+}
+
+typedef struct {
+    const BlockCodec* codec;
+    const Data*       data;
+    FILE*             file;      /* Input of the job (file globals are per thread, see common.h) */
+    MappedFile        mapped;
+    uint64_t          position;  /* Number of input bytes read */
+    uint64_t          offset;    /* Size of the archive written so far */
+    BlockIndex        index;
+    size_t            indexCapacity;
+    uint64_t          payloadBits;
+    uint64_t          unlimitedPayloadBits;
+    int               status;
+} ArchiveJob;
+
+/*
+ * Takes the next block of the input file. Blocks of the mapped input point to it directly
+ */
+static bool read_block(void* context, void* slot) {
+    ArchiveJob* job = context;
+    Block* block = slot;
+    size_t blockSize = job->data->blockSize;
+    if (job->mapped.data != NULL) {
+        block->inputSize = job->mapped.size - job->position < blockSize ? job->mapped.size - job->position : blockSize;
+        block->input = job->mapped.data + job->position;
+    } else {
+        block->inputSize = fread(block->buffer, sizeof(uint8_t), blockSize, job->file);
+        block->input = block->buffer;
+    }
+    job->position += block->inputSize;
+    return block->inputSize > 0;
+}
+
+static void encode_block(void* context, void* slot) {
+    ArchiveJob* job = context;
+    Block* block = slot;
+    bit_writer_reset(&block->output);
+    block->status = job->codec->encodeBlock(block->input, block->inputSize, &block->output,
+                                            job->data, &block->stats);
+}
+
+/*
+ * Reports a failed write of the output file, e.g. when the disk is full
+ */
+static int output_error(const Data* data) {
+    archiveError("can't write to file: %s", data->fileOut);
+    return FAILURE;
+}
+
+/*
+ * Output is buffered, so a write may fail only when it's flushed at the end
+ */
+static int flush_output(const Data* data) {
+    if (fflush(fileOut) != 0 || ferror(fileOut)) {
+        return output_error(data);
+    }
+    return 0;
+}
+
+static bool write_block(void* context, void* slot) {
+    ArchiveJob* job = context;
+    Block* block = slot;
+    if (block->status != 0) {
+        job->status = FAILURE;
+        return false;
+    }
+    write_uint32(block->inputSize, fileOut);
+    write_uint32(block->output.size, fileOut);
+    if (fwrite(block->output.buffer, sizeof(uint8_t), block->output.size, fileOut) != block->output.size ||
+        ferror(fileOut)) {
+        job->status = output_error(job->data);
+        return false;
+    }
+
+    job->offset += BLOCK_HEADER_SIZE;
+    BlockIndexEntry entry = {job->offset, block->output.size, block->inputSize};
+    add_index_entry(&job->index, &job->indexCapacity, entry);
+    job->offset += block->output.size;
+
+    job->payloadBits += block->stats.payloadBits;
+    job->unlimitedPayloadBits += block->stats.unlimitedPayloadBits;
+    return true;
+}
+
+/*
+ * Splits the input file into blocks of data->blockSize bytes and archives them
+ * independently. Reading, archiving on data->threads threads and writing blocks
+ * in order run as a pipeline (see run_pipeline())
+ */
+int blocks_archive(Data* data, const BlockCodec* codec) {
+    /* One slot per coder, plus one being read and one being written */
+    size_t slotsCount = data->threads + 2;
+    Block* blocks = malloc(slotsCount * sizeof(Block));
+    void** slots = malloc(slotsCount * sizeof(void*));
+    for (size_t i = 0; i < slotsCount; i++) {
+        blocks[i].buffer = mappedIn.data == NULL ? malloc(data->blockSize) : NULL;
+        bit_writer_init(&blocks[i].output, NULL);
+        slots[i] = &blocks[i];
+    }
+
+    uint8_t byte = BLOCKS_VERSION << BLOCKS_VERSION_SHIFT;
+    fwrite(&byte, sizeof(uint8_t), 1, fileOut);
+    fwrite(&codec->signature, sizeof(uint8_t), 1, fileOut);
+
+    ArchiveJob job = {codec, data, fileIn, mappedIn, 0, ARCHIVE_HEADER_SIZE, {NULL, 0}, 0, 0, 0, 0};
+    static const PipelineStages stages = {read_block, encode_block, write_block};
+    run_pipeline(&stages, &job, slots, slotsCount, data->threads);
+
+    /* End marker */
+    write_uint32(0, fileOut);
+    write_uint32(0, fileOut);
+    write_index(&job.index, fileOut);
+    blocks_free_index(&job.index);
+    if (job.status == 0) {
+        job.status = flush_output(data);
+    }
+
+    /* Size of standard input is known only after reading it */
+    if (data->fileInSize == FAILURE) {
+        data->fileInSize = job.position;
+    }
+
+    if (job.payloadBits != job.unlimitedPayloadBits) {
+        data->lengthLimitLoss = ((double) job.payloadBits / job.unlimitedPayloadBits - 1) * 100;
+    }
+
+    for (size_t i = 0; i < slotsCount; i++) {
+        free(blocks[i].buffer);
+        bit_writer_free(&blocks[i].output);
+    }
+    free(blocks);
+    free(slots);
+    return job.status;
+}
+
+/*
+ * Reads the block index from the end of an archive. Returns FAILURE if the archive
+ * has no index or it doesn't match the block layout
+ */
+int blocks_read_index(FILE* file, long fileSize, BlockIndex* index) {
+    index->entries = NULL;
+    index->count = 0;
+    long minSize = ARCHIVE_HEADER_SIZE + BLOCK_HEADER_SIZE + sizeof(uint64_t);
+    if (fileSize < minSize || fseek(file, fileSize - sizeof(uint64_t), SEEK_SET) != 0) {
+        return FAILURE;
+    }
+    uint64_t count = read_uint64(file);
+    if (count > (fileSize - minSize) / INDEX_ENTRY_SIZE) {
+        return FAILURE;
+    }
+    long indexOffset = fileSize - sizeof(uint64_t) - count * INDEX_ENTRY_SIZE;
+    fseek(file, indexOffset, SEEK_SET);
+
+    index->entries = malloc(count * sizeof(BlockIndexEntry));
+    index->count = count;
+    /* Blocks must follow each other, and the end marker must follow the last one */
+    uint64_t offset = ARCHIVE_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        BlockIndexEntry* entry = &index->entries[i];
+        entry->offset = read_uint64(file);
+        entry->archivedSize = read_uint32(file);
+        entry->originalSize = read_uint32(file);
+        if (entry->offset != offset + BLOCK_HEADER_SIZE || entry->originalSize == 0 ||
+            entry->originalSize > MAX_BLOCK_SIZE) {
+            blocks_free_index(index);
+            return FAILURE;
+        }
+        offset = entry->offset + entry->archivedSize;
+    }
+    if (offset + BLOCK_HEADER_SIZE != indexOffset) {
+        blocks_free_index(index);
+        return FAILURE;
+    }
+    return 0;
+}
+
+void blocks_free_index(BlockIndex* index) {
+    free(index->entries);
+    index->entries = NULL;
+    index->count = 0;
+}
+
+/*
+ * Returns **size** bytes of the input file at **offset**: a pointer to the mapped input,
+ * or to *buffer read with pread (the caller frees it). NULL if the file is too short
+ */
+static const uint8_t* read_input(const MappedFile* mapped, FILE* file, uint64_t offset, size_t size,
+                                 uint8_t** buffer) {
+    *buffer = NULL;
+    if (mapped->data != NULL) {
+        return offset + size <= mapped->size ? mapped->data + offset : NULL;
+    }
+    *buffer = malloc(size);
+    if (pread(fileno(file), *buffer, size, offset) != size) {
+        return NULL;
+    }
+    return *buffer;
+}
+
+typedef struct {
+    const BlockIndex* index;
+    const uint64_t*   outputOffsets;
+    int*              statuses;
+    const BlockCodec* codec;
+    const Data*       data;
+    FILE*             fileIn;
+    FILE*             fileOut;
+    MappedFile        mapped;
+} UnarchiveJob;
+
+/*
+ * Reads, unarchives and writes one block at its offset in the output file
+ */
+static void decode_task(void* context, size_t i) {
+    UnarchiveJob* job = context;
+    const BlockIndexEntry* entry = &job->index->entries[i];
+    uint8_t* buffer;
+    const uint8_t* input = read_input(&job->mapped, job->fileIn, entry->offset, entry->archivedSize, &buffer);
+    uint8_t* output = malloc(entry->originalSize);
+
+    int status = 0;
+    if (input == NULL ||
+        job->codec->decodeBlock(input, entry->archivedSize, output, entry->originalSize, job->data) != 0 ||
+        pwrite(fileno(job->fileOut), output, entry->originalSize, job->outputOffsets[i]) != entry->originalSize) {
+        status = FAILURE;
+    }
+    job->statuses[i] = status;
+
+    free(buffer);
+    free(output);
+}
+
+/*
+ * Unarchives indexed blocks on data->threads threads. Output offsets of the blocks
+ * are known from the index, so each block is written as soon as it's ready
+ */
+static int unarchive_parallel(const Data* data, const BlockCodec* codec, const BlockIndex* index) {
+    uint64_t* outputOffsets = malloc(index->count * sizeof(uint64_t));
+    int* statuses = malloc(index->count * sizeof(int));
+    uint64_t offset = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        outputOffsets[i] = offset;
+        offset += index->entries[i].originalSize;
+    }
+
+    UnarchiveJob job = {index, outputOffsets, statuses, codec, data, fileIn, fileOut, mappedIn};
+    parallel_for(index->count, data->threads, decode_task, &job);
+
+    int success = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        if (statuses[i] != 0) {
+            archiveError("invalid archive");
+            success = FAILURE;
+            break;
+        }
+    }
+    free(outputOffsets);
+    free(statuses);
+    return success;
+}
+
+/*
+ * Returns the next **size** bytes of the input: from the mapped input at *position,
+ * or read from the file into *buffer. NULL at the end of the input
+ */
+static const uint8_t* next_input(const MappedFile* mapped, FILE* file, size_t size, uint64_t* position,
+                                 uint8_t** buffer, size_t* capacity) {
+    if (mapped->data != NULL) {
+        if (size > mapped->size - *position) {
+            return NULL;
+        }
+        *position += size;
+        return mapped->data + *position - size;
+    }
+    if (size > *capacity) {
+        *capacity = size;
+        *buffer = realloc(*buffer, *capacity);
+    }
+    return fread(*buffer, sizeof(uint8_t), size, file) == size ? *buffer : NULL;
+}
+
+typedef struct {
+    const uint8_t* input;
+    uint8_t*       buffer;         /* Memory for input, when the input file isn't mapped */
+    size_t         bufferCapacity;
+    uint32_t       archivedSize;
+    uint8_t*       output;
+    size_t         outputCapacity;
+    uint32_t       originalSize;
+    int            status;
+} ArchivedBlock;
+
+typedef struct {
+    const BlockCodec* codec;
+    const Data*       data;
+    FILE*             file;
+    MappedFile        mapped;
+    uint64_t          position;    /* Position of the next block in the input file */
+    int               readStatus;
+    int               writeStatus;
+} SequentialJob;
+
+/*
+ * Takes the next block of the archive, returns false at the end marker or on error
+ */
+static bool read_archived_block(void* context, void* slot) {
+    SequentialJob* job = context;
+    ArchivedBlock* block = slot;
+    const uint8_t* header = next_input(&job->mapped, job->file, BLOCK_HEADER_SIZE, &job->position,
+                                       &block->buffer, &block->bufferCapacity);
+    if (header == NULL) {
+        archiveError("unexpected end of archive");
+        job->readStatus = FAILURE;
+        return false;
+    }
+    block->originalSize = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t) header[3] << 24;
+    block->archivedSize = header[4] | header[5] << 8 | header[6] << 16 | (uint32_t) header[7] << 24;
+    if (block->originalSize == 0 && block->archivedSize == 0) { /* End marker */
+        return false;
+    }
+    if (block->originalSize > MAX_BLOCK_SIZE) {
+        archiveError("invalid archive");
+        job->readStatus = FAILURE;
+        return false;
+    }
+
+    block->input = next_input(&job->mapped, job->file, block->archivedSize, &job->position,
+                              &block->buffer, &block->bufferCapacity);
+    if (block->input == NULL) {
+        archiveError("unexpected end of archive");
+        job->readStatus = FAILURE;
+        return false;
+    }
+    return true;
+}
+
+static void decode_archived_block(void* context, void* slot) {
+    SequentialJob* job = context;
+    ArchivedBlock* block = slot;
+    if (block->originalSize > block->outputCapacity) {
+        block->outputCapacity = block->originalSize;
+        block->output = realloc(block->output, block->outputCapacity);
+    }
+    block->status = job->codec->decodeBlock(block->input, block->archivedSize, block->output,
+                                            block->originalSize, job->data);
+}
+
+static bool write_archived_block(void* context, void* slot) {
+    SequentialJob* job = context;
+    ArchivedBlock* block = slot;
+    if (block->status != 0) {
+        archiveError("invalid archive");
+        job->writeStatus = FAILURE;
+        return false;
+    }
+    if (fwrite(block->output, sizeof(uint8_t), block->originalSize, fileOut) != block->originalSize) {
+        job->writeStatus = output_error(job->data);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Unarchives blocks in order until the end marker, reading, unarchiving and
+ * writing them as a pipeline. The archive version and signature must be already read
+ */
+static int unarchive_sequential(Data* data, const BlockCodec* codec) {
+    size_t slotsCount = data->threads + 2;
+    ArchivedBlock* blocks = calloc(slotsCount, sizeof(ArchivedBlock));
+    void** slots = malloc(slotsCount * sizeof(void*));
+    for (size_t i = 0; i < slotsCount; i++) {
+        slots[i] = &blocks[i];
+    }
+
+    SequentialJob job = {codec, data, fileIn, mappedIn, ARCHIVE_HEADER_SIZE, 0, 0};
+    static const PipelineStages stages = {read_archived_block, decode_archived_block, write_archived_block};
+    run_pipeline(&stages, &job, slots, slotsCount, data->threads);
+
+    for (size_t i = 0; i < slotsCount; i++) {
+        free(blocks[i].buffer);
+        free(blocks[i].output);
+    }
+    free(blocks);
+    free(slots);
+    if (job.readStatus == 0 && job.writeStatus == 0) {
+        job.writeStatus = flush_output(data);
+    }
+    return job.readStatus != 0 ? job.readStatus : job.writeStatus;
+}
+
+/*
+ * Unarchives blocks in parallel if there are several threads and the archive
+ * has an index, sequentially otherwise. The archive version and signature
+ * must be already read
+ */
+int blocks_unarchive(Data* data, const BlockCodec* codec) {
+    if (data->threads > 1 && is_regular_file(fileOut)) {
+        BlockIndex index;
+        if (blocks_read_index(fileIn, data->fileInSize, &index) == 0) {
+            int success = unarchive_parallel(data, codec, &index);
+            blocks_free_index(&index);
+            return success;
+        }
+        fseek(fileIn, ARCHIVE_HEADER_SIZE, SEEK_SET);
+    }
+    return unarchive_sequential(data, codec);
+}
+
+/*
+ * Unarchives **length** bytes of the original file, starting at **offset**.
+ * Only the blocks covering the range are read, so the archive must have an index.
+ * A range that goes past the end of the file is cut
+ */
+int blocks_extract(Data* data, const BlockCodec* codec, uint64_t offset, uint64_t length) {
+    BlockIndex index;
+    if (blocks_read_index(fileIn, data->fileInSize, &index) != 0) {
+        archiveError("the archive has no block index");
+        return FAILURE;
+    }
+
+    /* Find the block containing the first byte of the range */
+    size_t i = 0;
+    uint64_t blockOffset = 0; /* Offset of block i in the original file */
+    while (i < index.count && blockOffset + index.entries[i].originalSize <= offset) {
+        blockOffset += index.entries[i].originalSize;
+        i++;
+    }
+    if (i == index.count) {
+        archiveError("the range starts past the end of the file (%llu bytes)", (unsigned long long) blockOffset);
+        blocks_free_index(&index);
+        return FAILURE;
+    }
+
+    uint64_t end = length > UINT64_MAX - offset ? UINT64_MAX : offset + length;
+    int success = 0;
+    for (; i < index.count && blockOffset < end; i++) {
+        const BlockIndexEntry* entry = &index.entries[i];
+        uint8_t* buffer;
+        const uint8_t* input = read_input(&mappedIn, fileIn, entry->offset, entry->archivedSize, &buffer);
+        uint8_t* output = malloc(entry->originalSize);
+
+        if (input == NULL ||
+            codec->decodeBlock(input, entry->archivedSize, output, entry->originalSize, data) != 0) {
+            archiveError("invalid archive");
+            success = FAILURE;
+        } else {
+            /* Write the part of the block inside the range */
+            uint64_t from = offset > blockOffset ? offset - blockOffset : 0;
+            uint64_t to = end - blockOffset < entry->originalSize ? end - blockOffset : entry->originalSize;
+            if (fwrite(output + from, sizeof(uint8_t), to - from, fileOut) != to - from) {
+                success = output_error(data);
+            }
+            data->fileOutSize += to - from;
+        }
+
+        free(buffer);
+        free(output);
+        if (success != 0) {
+            break;
+        }
+        blockOffset += entry->originalSize;
+    }
+
+    blocks_free_index(&index);
+    if (success == 0) {
+        success = flush_output(data);
+    }
+    return success;
+}
+
+/*
+ * Archives with a block codec, in blocks of DEFAULT_BLOCK_SIZE unless data->blockSize is given.
+ * The functions below are all a codec needs for the command line tool
+ */
+int blocks_codec_archive(Data* data, const BlockCodec* codec) {
+    if (data->blockSize == 0) {
+        data->blockSize = DEFAULT_BLOCK_SIZE;
+    }
+    return blocks_archive(data, codec);
+}
+
+/*
+ * Reads the version and signature of an archive of the codec
+ */
+static int read_heading(const BlockCodec* codec) {
+    uint8_t firstByte = 0, signature = 0;
+    fread(&firstByte, sizeof(uint8_t), 1, fileIn);
+    fread(&signature, sizeof(uint8_t), 1, fileIn);
+    if (signature != codec->signature || firstByte >> BLOCKS_VERSION_SHIFT != BLOCKS_VERSION) {
+        archiveError("invalid archive");
+        return FAILURE;
+    }
+    return 0;
+}
+
+int blocks_codec_unarchive(Data* data, const BlockCodec* codec) {
+    if (read_heading(codec) != 0) {
+        return FAILURE;
+    }
+    return blocks_unarchive(data, codec);
+}
+
+/*
+ * Unarchives data->rangeLength bytes of the original file from data->rangeOffset
+ */
+int blocks_codec_extract(Data* data, const BlockCodec* codec) {
+    if (read_heading(codec) != 0) {
+        return FAILURE;
+    }
+    return blocks_extract(data, codec, data->rangeOffset, data->rangeLength);
+}
+
+/*
+ * Returns the max size of a block archive of **size** bytes
+ */
+size_t blocks_bound(const BlockCodec* codec, size_t size, size_t blockSize) {
+    size_t count = (size + blockSize - 1) / blockSize;
+    size_t bound = ARCHIVE_HEADER_SIZE + BLOCK_HEADER_SIZE + sizeof(uint64_t) +
+                   count * (BLOCK_HEADER_SIZE + INDEX_ENTRY_SIZE);
+    if (count > 0) {
+        bound += (count - 1) * codec->boundBlock(blockSize) + codec->boundBlock(size - (count - 1) * blockSize);
+    }
+    return bound;
+}
+
+static void store_le(uint8_t* dst, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        dst[i] = (value >> (i * BYTE_SIZE)) & 0xff;
+    }
+}
+
+static uint32_t load_le32(const uint8_t* src) {
+    return src[0] | src[1] << 8 | src[2] << 16 | (uint32_t) src[3] << 24;
+}
+
+typedef struct {
+    const BlockCodec* codec;
+    const Data*       data;
+    const uint8_t*    src;
+    size_t            srcSize;
+    size_t            first;   /* Number of the first block of the batch */
+    Block*            blocks;
+} MemoryBatch;
+
+static void encode_memory_task(void* context, size_t i) {
+    MemoryBatch* batch = context;
+    Block* block = &batch->blocks[i];
+    size_t offset = (batch->first + i) * batch->data->blockSize;
+    block->input = batch->src + offset;
+    block->inputSize = batch->srcSize - offset < batch->data->blockSize ? batch->srcSize - offset
+                                                                         : batch->data->blockSize;
+    bit_writer_reset(&block->output);
+    block->status = batch->codec->encodeBlock(block->input, block->inputSize, &block->output,
+                                              batch->data, &block->stats);
+}
+
+/*
+ * Archives a memory block into dst, in the same format as blocks_archive().
+ * Batches of data->threads blocks are archived in parallel.
+ * Returns the archive size, or FAILURE if it doesn't fit into **dstCapacity** bytes
+ */
+long blocks_compress_memory(const BlockCodec* codec, const Data* data, const uint8_t* src, size_t srcSize,
+                            uint8_t* dst, size_t dstCapacity) {
+    size_t count = (srcSize + data->blockSize - 1) / data->blockSize;
+    if (dstCapacity < ARCHIVE_HEADER_SIZE) {
+        return FAILURE;
+    }
+    dst[0] = BLOCKS_VERSION << BLOCKS_VERSION_SHIFT;
+    dst[1] = codec->signature;
+    size_t size = ARCHIVE_HEADER_SIZE;
+
+    size_t slots = data->threads;
+    Block* blocks = malloc(slots * sizeof(Block));
+    for (size_t i = 0; i < slots; i++) {
+        bit_writer_init(&blocks[i].output, NULL);
+    }
+    BlockIndexEntry* entries = malloc(count * sizeof(BlockIndexEntry));
+    MemoryBatch batch = {codec, data, src, srcSize, 0, blocks};
+
+    int success = 0;
+    while (batch.first < count && success == 0) {
+        size_t batchSize = count - batch.first < slots ? count - batch.first : slots;
+        parallel_for(batchSize, data->threads, encode_memory_task, &batch);
+
+        for (size_t i = 0; i < batchSize; i++) {
+            Block* block = &blocks[i];
+            if (block->status != 0 || dstCapacity - size < BLOCK_HEADER_SIZE + block->output.size) {
+                success = FAILURE;
+                break;
+            }
+            store_le(dst + size, block->inputSize, sizeof(uint32_t));
+            store_le(dst + size + sizeof(uint32_t), block->output.size, sizeof(uint32_t));
+            size += BLOCK_HEADER_SIZE;
+            memcpy(dst + size, block->output.buffer, block->output.size);
+
+            BlockIndexEntry entry = {size, block->output.size, block->inputSize};
+            entries[batch.first + i] = entry;
+            size += block->output.size;
+        }
+        batch.first += batchSize;
+    }
+
+    /* End marker and index */
+    if (success == 0 && dstCapacity - size >= BLOCK_HEADER_SIZE + count * INDEX_ENTRY_SIZE + sizeof(uint64_t)) {
+        memset(dst + size, 0, BLOCK_HEADER_SIZE);
+        size += BLOCK_HEADER_SIZE;
+        for (size_t i = 0; i < count; i++) {
+            store_le(dst + size, entries[i].offset, sizeof(uint64_t));
+            store_le(dst + size + sizeof(uint64_t), entries[i].archivedSize, sizeof(uint32_t));
+            store_le(dst + size + sizeof(uint64_t) + sizeof(uint32_t), entries[i].originalSize, sizeof(uint32_t));
+            size += INDEX_ENTRY_SIZE;
+        }
+        store_le(dst + size, count, sizeof(uint64_t));
+        size += sizeof(uint64_t);
+    } else {
+        success = FAILURE;
+    }
+
+    for (size_t i = 0; i < slots; i++) {
+        bit_writer_free(&blocks[i].output);
+    }
+    free(blocks);
+    free(entries);
+    return success == 0 ? (long) size : FAILURE;
+}
+
+/*
+ * Collects the blocks of an in-memory block archive by their headers.
+ * Returns the unarchived size, or FAILURE if the archive is broken
+ */
+static long find_memory_blocks(const uint8_t* src, size_t srcSize, BlockIndex* index) {
+    index->entries = NULL;
+    index->count = 0;
+    size_t capacity = 0;
+    if (srcSize < ARCHIVE_HEADER_SIZE || src[0] >> BLOCKS_VERSION_SHIFT != BLOCKS_VERSION) {
+        return FAILURE;
+    }
+
+    size_t position = ARCHIVE_HEADER_SIZE;
+    long size = 0;
+    while (true) {
+        if (srcSize - position < BLOCK_HEADER_SIZE) {
+            blocks_free_index(index);
+            return FAILURE;
+        }
+        uint32_t originalSize = load_le32(src + position);
+        uint32_t archivedSize = load_le32(src + position + sizeof(uint32_t));
+        position += BLOCK_HEADER_SIZE;
+        if (originalSize == 0 && archivedSize == 0) { /* End marker */
+            return size;
+        }
+        if (originalSize > MAX_BLOCK_SIZE || archivedSize > srcSize - position) {
+            blocks_free_index(index);
+            return FAILURE;
+        }
+        BlockIndexEntry entry = {position, archivedSize, originalSize};
+        add_index_entry(index, &capacity, entry);
+        position += archivedSize;
+        size += originalSize;
+    }
+}
+
+/*
+ * Returns the unarchived size of an in-memory block archive, or FAILURE if it's broken
+ */
+long blocks_decompressed_size(const uint8_t* src, size_t srcSize) {
+    BlockIndex index;
+    long size = find_memory_blocks(src, srcSize, &index);
+    blocks_free_index(&index);
+    return size;
+}
+
+typedef struct {
+    const BlockIndex* index;
+    const BlockCodec* codec;
+    const Data*       data;
+    const uint8_t*    src;
+    uint8_t*          dst;
+    const uint64_t*   outputOffsets;
+    int*              statuses;
+} MemoryJob;
+
+static void decode_memory_task(void* context, size_t i) {
+    MemoryJob* job = context;
+    const BlockIndexEntry* entry = &job->index->entries[i];
+    job->statuses[i] = job->codec->decodeBlock(job->src + entry->offset, entry->archivedSize,
+                                               job->dst + job->outputOffsets[i], entry->originalSize, job->data);
+}
+
+/*
+ * Unarchives an in-memory block archive into dst, the blocks are unarchived in parallel
+ * straight to their places. Returns the unarchived size, or FAILURE if the archive is broken
+ * or doesn't fit into **dstCapacity** bytes
+ */
+long blocks_decompress_memory(const BlockCodec* codec, const Data* data, const uint8_t* src, size_t srcSize,
+                              uint8_t* dst, size_t dstCapacity) {
+    BlockIndex index;
+    long size = find_memory_blocks(src, srcSize, &index);
+    if (size == FAILURE || src[1] != codec->signature || (size_t) size > dstCapacity) {
+        blocks_free_index(&index);
+        return FAILURE;
+    }
+
+    uint64_t* outputOffsets = malloc(index.count * sizeof(uint64_t));
+    int* statuses = malloc(index.count * sizeof(int));
+    uint64_t offset = 0;
+    for (size_t i = 0; i < index.count; i++) {
+        outputOffsets[i] = offset;
+        offset += index.entries[i].originalSize;
+    }
+
+    MemoryJob job = {&index, codec, data, src, dst, outputOffsets, statuses};
+    parallel_for(index.count, data->threads, decode_memory_task, &job);
+    for (size_t i = 0; i < index.count; i++) {
+        if (statuses[i] != 0) {
+            size = FAILURE;
+            break;
+        }
+    }
+
+    free(outputOffsets);
+    free(statuses);
+    blocks_free_index(&index);
+    return size;
+}
+
+static void reserve(uint8_t** buffer, size_t* capacity, size_t size) {
+    if (*capacity < size) {
+        *buffer = realloc(*buffer, size);
+        *capacity = size;
+    }
+}
+
+static void stream_init(BlockStream* stream, const BlockCodec* codec, FindCodecFn findCodec, const Data* data) {
+    memset(stream, 0, sizeof(BlockStream));
+    stream->codec = codec;
+    stream->findCodec = findCodec;
+    stream->data = data;
+    bit_writer_init(&stream->writer, NULL);
+}
+
+/*
+ * Moves as much pending output as fits into out
+ */
+static void stream_drain(BlockStream* stream, StreamOutput* out) {
+    size_t size = stream->outputSize - stream->outputPosition;
+    if (size > out->size - out->position) {
+        size = out->size - out->position;
+    }
+    if (size > 0) {
+        memcpy(out->data + out->position, stream->output + stream->outputPosition, size);
+    }
+    out->position += size;
+    stream->outputPosition += size;
+}
+
+/*
+ * Moves input into the collected data, up to **size** bytes in total.
+ * Returns true if there are **size** bytes now
+ */
+static bool stream_collect(uint8_t* collected, size_t* collectedSize, size_t size, StreamInput* in) {
+    size_t count = size - *collectedSize;
+    if (count > in->size - in->position) {
+        count = in->size - in->position;
+    }
+    if (count > 0) {
+        memcpy(collected + *collectedSize, in->data + in->position, count);
+    }
+    *collectedSize += count;
+    in->position += count;
+    return *collectedSize == size;
+}
+
+void blocks_stream_init_archiving(BlockStream* stream, const BlockCodec* codec, const Data* data) {
+    stream_init(stream, codec, NULL, data);
+    reserve(&stream->input, &stream->inputCapacity, data->blockSize);
+    reserve(&stream->output, &stream->outputCapacity, BLOCK_HEADER_SIZE + codec->boundBlock(data->blockSize));
+    stream->output[0] = BLOCKS_VERSION << BLOCKS_VERSION_SHIFT;
+    stream->output[1] = codec->signature;
+    stream->outputSize = ARCHIVE_HEADER_SIZE;
+}
+
+static int stream_encode_block(BlockStream* stream) {
+    BlockStats stats;
+    bit_writer_reset(&stream->writer);
+    if (stream->codec->encodeBlock(stream->input, stream->inputSize, &stream->writer, stream->data, &stats) != 0) {
+        return FAILURE;
+    }
+    reserve(&stream->output, &stream->outputCapacity, BLOCK_HEADER_SIZE + stream->writer.size);
+    store_le(stream->output, stream->inputSize, sizeof(uint32_t));
+    store_le(stream->output + sizeof(uint32_t), stream->writer.size, sizeof(uint32_t));
+    memcpy(stream->output + BLOCK_HEADER_SIZE, stream->writer.buffer, stream->writer.size);
+    stream->outputSize = BLOCK_HEADER_SIZE + stream->writer.size;
+    stream->outputPosition = 0;
+    stream->inputSize = 0;
+    return 0;
+}
+
+/*
+ * Archives input into out, until either the input is consumed or out is full.
+ * Returns the number of archived bytes which didn't fit into out, or FAILURE.
+ * With STREAM_FLUSH or STREAM_FINISH, call again with more output space
+ * until 0 is returned; after that the output ends on a block boundary
+ * (or is a complete archive)
+ */
+long blocks_stream_archive(BlockStream* stream, StreamInput* in, StreamOutput* out, StreamFlush flush) {
+    if (stream->failed || (stream->finished && in->position < in->size)) {
+        stream->failed = true;
+        return FAILURE;
+    }
+    while (true) {
+        stream_drain(stream, out);
+        if (stream->outputPosition < stream->outputSize || stream->finished) {
+            return stream->outputSize - stream->outputPosition;
+        }
+
+        bool full = stream_collect(stream->input, &stream->inputSize, stream->data->blockSize, in);
+        bool consumed = in->position == in->size;
+        if (full || (consumed && flush != STREAM_RUN && stream->inputSize > 0)) {
+            if (stream_encode_block(stream) != 0) {
+                stream->failed = true;
+                return FAILURE;
+            }
+        } else if (consumed && flush == STREAM_FINISH) {
+            memset(stream->output, 0, BLOCK_HEADER_SIZE); /* End marker */
+            stream->outputSize = BLOCK_HEADER_SIZE;
+            stream->outputPosition = 0;
+            stream->finished = true;
+        } else {
+            return 0;
+        }
+    }
+}
+
+void blocks_stream_init_unarchiving(BlockStream* stream, FindCodecFn findCodec, const Data* data) {
+    stream_init(stream, NULL, findCodec, data);
+}
+
+/*
+ * Reads the archive header or a block header, once all of its bytes are collected
+ */
+static int stream_read_header(BlockStream* stream) {
+    if (stream->codec == NULL) {
+        stream->headerSize = 0;
+        if (stream->header[0] >> BLOCKS_VERSION_SHIFT != BLOCKS_VERSION) {
+            return FAILURE;
+        }
+        stream->codec = stream->findCodec(stream->header[1]);
+        return stream->codec == NULL ? FAILURE : 0;
+    }
+
+    uint32_t originalSize = load_le32(stream->header);
+    uint32_t archivedSize = load_le32(stream->header + sizeof(uint32_t));
+    if (originalSize == 0 && archivedSize == 0) { /* End marker */
+        stream->finished = true;
+        return 0;
+    }
+    if (originalSize == 0 || originalSize > MAX_BLOCK_SIZE ||
+        archivedSize > stream->codec->boundBlock(originalSize)) {
+        return FAILURE;
+    }
+    reserve(&stream->input, &stream->inputCapacity, archivedSize);
+    reserve(&stream->output, &stream->outputCapacity, originalSize);
+    return 0;
+}
+
+/*
+ * Unarchives input into out, until either the input is consumed or out is full.
+ * Returns 0 when the whole archive is unarchived and given out, a positive number
+ * while more input or output space is needed, or FAILURE if the archive is broken.
+ * Input after the end marker (like the index) isn't consumed
+ */
+long blocks_stream_unarchive(BlockStream* stream, StreamInput* in, StreamOutput* out) {
+    if (stream->failed) {
+        return FAILURE;
+    }
+    while (true) {
+        stream_drain(stream, out);
+        if (stream->outputPosition < stream->outputSize) {
+            return stream->outputSize - stream->outputPosition;
+        }
+        if (stream->finished) {
+            return 0;
+        }
+
+        size_t headerSize = stream->codec == NULL ? ARCHIVE_HEADER_SIZE : BLOCK_HEADER_SIZE;
+        if (stream->headerSize < headerSize) {
+            if (!stream_collect(stream->header, &stream->headerSize, headerSize, in)) {
+                return headerSize - stream->headerSize;
+            }
+            if (stream_read_header(stream) != 0) {
+                stream->failed = true;
+                return FAILURE;
+            }
+            continue;
+        }
+
+        uint32_t originalSize = load_le32(stream->header);
+        uint32_t archivedSize = load_le32(stream->header + sizeof(uint32_t));
+        if (!stream_collect(stream->input, &stream->inputSize, archivedSize, in)) {
+            return archivedSize - stream->inputSize;
+        }
+        if (stream->codec->decodeBlock(stream->input, archivedSize, stream->output, originalSize, stream->data) != 0) {
+            stream->failed = true;
+            return FAILURE;
+        }
+        stream->outputSize = originalSize;
+        stream->outputPosition = 0;
+        stream->inputSize = 0;
+        stream->headerSize = 0;
+    }
+}
+
+void blocks_stream_free(BlockStream* stream) {
+    free(stream->input);
+    free(stream->output);
+    bit_writer_free(&stream->writer);
+}
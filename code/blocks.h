@@ -0,0 +1,139 @@
+#ifndef BLOCKS_H
+#define BLOCKS_H
+
+#include "common.h"
+#include "data.h"
+#include "bitio.h"
+
+/*
+ * Version of block archives, written to the high nibble of the first byte
+ * (versions 0-2 are single-stream Huffman archives, see huffman/heading.h)
+ *
+ * Block archive layout:
+ * 1 byte  - version
+ * 1 byte  - signature of the codec
+ * For each block:
+ *   4 bytes - size of unarchived block data, little-endian
+ *   4 bytes - size of archived block data, little-endian
+ *   X bytes - archived block data
+ * 8 bytes   - end marker (two zero sizes)
+ * Block index, for parallel and random access unarchiving:
+ *   For each block:
+ *     8 bytes - offset of archived block data in the archive
+ *     4 bytes - size of archived block data
+ *     4 bytes - size of unarchived block data
+ *   8 bytes - number of blocks
+ * All numbers are little-endian. Archives without a valid index
+ * are unarchived sequentially
+ */
+#define BLOCKS_VERSION 3
+#define BLOCKS_VERSION_SHIFT 4
+
+/* Codec statistics of one block */
+typedef struct {
+    uint64_t payloadBits;          /* Size of entropy coded data */
+    uint64_t unlimitedPayloadBits; /* Size it would have without the code length limit */
+} BlockStats;
+
+/*
+ * Archives **size** bytes of src, writing them to an in-memory writer
+ */
+typedef int (*EncodeBlockFn)(const uint8_t* src, size_t size, BitWriter* writer,
+                             const Data* data, BlockStats* stats);
+/*
+ * Unarchives **srcSize** bytes of src, which must give exactly **dstSize** bytes
+ */
+typedef int (*DecodeBlockFn)(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize,
+                             const Data* data);
+/*
+ * Returns the max size of **size** bytes archived by the codec
+ */
+typedef size_t (*BoundBlockFn)(size_t size);
+
+typedef struct {
+    uint64_t offset;       /* Offset of archived block data in the archive */
+    uint32_t archivedSize;
+    uint32_t originalSize;
+} BlockIndexEntry;
+
+typedef struct {
+    BlockIndexEntry* entries;
+    size_t           count;
+} BlockIndex;
+
+typedef struct {
+    uint8_t       signature;
+    EncodeBlockFn encodeBlock;
+    DecodeBlockFn decodeBlock;
+    BoundBlockFn  boundBlock;
+} BlockCodec;
+
+/* Finds the codec of an archive by its signature, NULL if there's none */
+typedef const BlockCodec* (*FindCodecFn)(uint8_t signature);
+
+typedef struct {
+    const uint8_t* data;
+    size_t         size;
+    size_t         position; /* Number of bytes consumed */
+} StreamInput;
+
+typedef struct {
+    uint8_t* data;
+    size_t   size;
+    size_t   position;       /* Number of bytes written */
+} StreamOutput;
+
+typedef enum {
+    STREAM_RUN,    /* Archive whole blocks only */
+    STREAM_FLUSH,  /* Also archive the collected input as a shorter block */
+    STREAM_FINISH  /* Flush and end the archive */
+} StreamFlush;
+
+/*
+ * State of incremental archiving or unarchiving. When archiving, input is
+ * collected into blocks of data->blockSize bytes; when unarchiving, a whole
+ * archived block is collected before it's unarchived. So memory use is bounded
+ * by the block size, and archived data is produced or consumed block by block.
+ * Stream archives have no index
+ */
+typedef struct {
+    const BlockCodec* codec;
+    FindCodecFn       findCodec;
+    const Data*       data;
+    uint8_t*          input;           /* Collected unarchived (archived) block */
+    size_t            inputSize;
+    size_t            inputCapacity;
+    uint8_t*          output;          /* Archived (unarchived) data waiting for output space */
+    size_t            outputSize;
+    size_t            outputPosition;  /* Number of output bytes already given out */
+    size_t            outputCapacity;
+    uint8_t           header[2 * sizeof(uint32_t)];
+    size_t            headerSize;      /* Number of collected header bytes */
+    BitWriter         writer;
+    bool              finished;
+    bool              failed;
+} BlockStream;
+
+int blocks_archive(Data* data, const BlockCodec* codec);
+int blocks_unarchive(Data* data, const BlockCodec* codec);
+int blocks_extract(Data* data, const BlockCodec* codec, uint64_t offset, uint64_t length);
+int blocks_codec_archive(Data* data, const BlockCodec* codec);
+int blocks_codec_unarchive(Data* data, const BlockCodec* codec);
+int blocks_codec_extract(Data* data, const BlockCodec* codec);
+int blocks_read_index(FILE* file, long fileSize, BlockIndex* index);
+void blocks_free_index(BlockIndex* index);
+
+size_t blocks_bound(const BlockCodec* codec, size_t size, size_t blockSize);
+long blocks_compress_memory(const BlockCodec* codec, const Data* data, const uint8_t* src, size_t srcSize,
+                            uint8_t* dst, size_t dstCapacity);
+long blocks_decompressed_size(const uint8_t* src, size_t srcSize);
+long blocks_decompress_memory(const BlockCodec* codec, const Data* data, const uint8_t* src, size_t srcSize,
+                              uint8_t* dst, size_t dstCapacity);
+
+void blocks_stream_init_archiving(BlockStream* stream, const BlockCodec* codec, const Data* data);
+void blocks_stream_init_unarchiving(BlockStream* stream, FindCodecFn findCodec, const Data* data);
+long blocks_stream_archive(BlockStream* stream, StreamInput* in, StreamOutput* out, StreamFlush flush);
+long blocks_stream_unarchive(BlockStream* stream, StreamInput* in, StreamOutput* out);
+void blocks_stream_free(BlockStream* stream);
+
+#endif
@@ -1,17 +1,46 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "common.h"
 
-Sequence outByte = {0};
+_Thread_local uint8_t bufferIn[BLOCK_SIZE];
+_Thread_local uint8_t bufferOut[BLOCK_SIZE];
+_Thread_local size_t  bufferIndexIn = 0;
+_Thread_local size_t  bufferIndexOut = 0;
 
-uint8_t bufferIn[BLOCK_SIZE];
-uint8_t bufferOut[BLOCK_SIZE];
-size_t  bufferIndexIn = 0;
-size_t  bufferIndexOut = 0;
+_Thread_local FILE* fileIn;
+_Thread_local FILE* fileOut;
+_Thread_local MappedFile mappedIn = {NULL, 0};
 
-FILE* fileIn;
-FILE* fileOut;
+/*
+ * Maps fileIn to memory if it's a regular file. The input is mostly read
+ * front to back, so the kernel is advised to read ahead
+ */
+void map_input() {
+    mappedIn.data = NULL;
+    mappedIn.size = 0;
+    struct stat info;
+    if (fstat(fileno(fileIn), &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+        return;
+    }
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fileno(fileIn), 0);
+    if (data == MAP_FAILED) {
+        return;
+    }
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+    mappedIn.data = data;
+    mappedIn.size = info.st_size;
+}
+
+void unmap_input() {
+    if (mappedIn.data != NULL) {
+        munmap((void*) mappedIn.data, mappedIn.size);
+        mappedIn.data = NULL;
+        mappedIn.size = 0;
+    }
+}
 
 size_t update_buffer() {
     return fread(bufferIn, sizeof(uint8_t), BLOCK_SIZE, fileIn);
@@ -23,116 +52,62 @@ void flush_buffer() {
 }
 
 /*
- * Generates and outputs the bytes from the incomplete byte
- * until its size becomes less than 8 bits
+ * Outputs a single byte through the output buffer. Bit output goes through
+ * BitWriter (see bitio.h)
  */
-static void reduce_seq() {
-    if (outByte.size < BYTE_SIZE) {
-        return;
-    }
-    while (outByte.size >= BYTE_SIZE) {
-        if (outByte.size == BYTE_SIZE) {
-            output_byte(outByte.value);
-            outByte.size = 0;
-            outByte.value = 0;
-            return;
-        }
-        /* Constructing the byte */
-        uint8_t byte = outByte.value >> (outByte.size - BYTE_SIZE);
-        output_byte(byte);
-        outByte.size -= BYTE_SIZE;
-        outByte.value &= ((1 << outByte.size) - 1); /* Nullify unused bits */
+void output_byte(uint8_t byte) {
+    if (bufferIndexOut >= BLOCK_SIZE) {
+        flush_buffer(bufferIndexOut);
     }
+    bufferOut[bufferIndexOut] = byte;
+    bufferIndexOut++;
 }
 
 /*
- * Flush last incomplete byte and return the number of
- * extra bits added to the end of file
+ * Writes **size** low bytes of value, least significant byte first
  */
-int flush_incomplete_bytes() {
-    reduce_seq();
-    flush_buffer();
-
-    if (outByte.size == 0) {
-        return 0;
+static void write_le(uint64_t value, size_t size, FILE* file) {
+    uint8_t bytes[sizeof(uint64_t)];
+    for (size_t i = 0; i < size; i++) {
+        bytes[i] = (value >> (i * BYTE_SIZE)) & 0xff;
     }
-
-    /* Processing the rest of the sequence */
-    uint8_t extraBits = (BYTE_SIZE - outByte.size);
-    uint8_t byte = outByte.value << extraBits;
-    fputc(byte, fileOut);
-    outByte.size = 0;
-    outByte.value = 0;
-    return extraBits;
+    fwrite(bytes, sizeof(uint8_t), size, file);
 }
 
 /*
- * Use this function only when you aren't using **output_bit_sequence()**!!
- * Otherwise, output only bit sequences (val = byte, size = 8)
+ * Reads a value of **size** bytes written by write_le()
  */
-void output_byte(uint8_t byte) {
-    if (bufferIndexOut >= BLOCK_SIZE) {
-        flush_buffer(bufferIndexOut);
+static uint64_t read_le(size_t size, FILE* file) {
+    uint8_t bytes[sizeof(uint64_t)] = {0};
+    fread(bytes, sizeof(uint8_t), size, file);
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (uint64_t) bytes[i] << (i * BYTE_SIZE);
     }
-    bufferOut[bufferIndexOut] = byte;
-    bufferIndexOut++;
+    return value;
 }
 
-void output_bit_sequence(Sequence seq) {
-    if (seq.size == 0) {
-        return;
-    }
-
-    /* Zero out garbage bits */
-    uint32_t mask = (1 << seq.size) - 1;
-    seq.value &= mask;
-
-    /* If current sequence is already longer than 8 bits */
-    reduce_seq();
-
-    /* It's possible to output a full byte */
-    if (seq.size + outByte.size >= BYTE_SIZE) {
-        /* Generating the byte to output */
-        uint8_t byte = outByte.value << (BYTE_SIZE - outByte.size); /* First half */
-        int bitsLeft = BYTE_SIZE - outByte.size; /* Bits left to complete the byte */
-        byte |= (seq.value >> (seq.size - bitsLeft)); /* Second half */
-        output_byte(byte);
+void write_uint32(uint32_t value, FILE* file) {
+    write_le(value, sizeof(uint32_t), file);
+}
 
-        /* Updating outByte */
-        outByte.size = seq.size - bitsLeft;
-        outByte.value = seq.value &= ((1 << outByte.size) - 1); /* Nullify unused bits */
-        return;
-    }
+uint32_t read_uint32(FILE* file) {
+    return read_le(sizeof(uint32_t), file);
+}
 
-    /* Can't output a byte yet, not enough bits accumulated */
-    outByte.value <<= seq.size;
-    outByte.value |= seq.value;
-    outByte.size += seq.size;
+void write_uint64(uint64_t value, FILE* file) {
+    write_le(value, sizeof(uint64_t), file);
 }
 
-bool at_end(FILE* file) {
-    off_t current = ftell(file);
-    fseek(file, 0, SEEK_END);
-    off_t end = ftell(file);
-    fseek(file, current, SEEK_SET);  /* Back to where we started */
-    return current == end;
+uint64_t read_uint64(FILE* file) {
+    return read_le(sizeof(uint64_t), file);
 }
 
 /*
- * Determines the number of unique bytes in file
- * Returns true if the file has 2+ unique bytes
+ * Returns true if the file is a regular file, which supports seeking
+ * (unlike pipes or terminals)
  */
-bool is_file_correct(FILE* file) {
-    uint8_t firstByte;
-    fread(&firstByte, sizeof(uint8_t), 1, fileIn);
-    uint8_t secondByte = firstByte;
-    while (fread(&secondByte, sizeof(uint8_t), 1, fileIn) != 0) {
-        if (firstByte != secondByte) {
-#ifdef DEBUG
-            printf("First two bytes: %c, %c\n\n", firstByte, secondByte);
-#endif
-            return true;
-        }
-    }
-    return false;
-}
\ No newline at end of file
+bool is_regular_file(FILE* file) {
+    struct stat info;
+    return fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode);
+}
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #define FAILURE -1
 //#define DEBUG
@@ -14,6 +15,11 @@
 /* Signatures */
 #define SIG_HUFFMAN          0x3a
 #define SIG_ADAPTIVE_HUFFMAN 0x3b
+#define SIG_LZ               0x3c
+#define SIG_FAST             0x3d
+#define SIG_ANS              0x3e
+#define SIG_RANGE_CODER      0x3f
+#define SIG_BWT              0x40
 
 #define BLOCK_SIZE 65536
 
@@ -30,24 +36,39 @@ typedef struct {
     size_t size;    /* Size of value in bits */
 } Sequence;
 
+/**
+ * Input file mapped to memory. Data is NULL when the input can't be
+ * mapped (pipes, empty files), then it's read through fileIn
+ */
+typedef struct {
+    const uint8_t* data;
+    size_t         size;
+} MappedFile;
 
-extern Sequence outByte; /* Incomplete output byte */
-
-extern uint8_t bufferIn[BLOCK_SIZE];
-extern uint8_t bufferOut[BLOCK_SIZE];
-extern size_t  bufferIndexOut;
-extern size_t bufferIndexIn;
+/*
+ * Files of the operation running on the current thread. Each thread has its own,
+ * so several files can be archived at once (see batch.h). Threads helping with
+ * an operation get its files from the caller
+ */
+extern _Thread_local uint8_t bufferIn[BLOCK_SIZE];
+extern _Thread_local uint8_t bufferOut[BLOCK_SIZE];
+extern _Thread_local size_t  bufferIndexOut;
+extern _Thread_local size_t bufferIndexIn;
 
-extern FILE* fileIn;
-extern FILE* fileOut;
+extern _Thread_local FILE* fileIn;
+extern _Thread_local FILE* fileOut;
+extern _Thread_local MappedFile mappedIn;
 
+void map_input();
+void unmap_input();
 size_t update_buffer();
 void flush_buffer();
-int flush_incomplete_bytes();
 void output_byte(uint8_t byte);
-void output_bit_sequence(Sequence seq);
 
-bool at_end(FILE* file);
-bool is_file_correct(FILE* file);
+void write_uint32(uint32_t value, FILE* file);
+uint32_t read_uint32(FILE* file);
+void write_uint64(uint64_t value, FILE* file);
+uint64_t read_uint64(FILE* file);
+bool is_regular_file(FILE* file);
 
 #endif
\ No newline at end of file
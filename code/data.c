@@ -1,7 +1,7 @@
 #include "data.h"
 
 void dataError(const char* message) {
-    printf("Error: %s.\n", message);
+    fprintf(stderr, "Error: %s.\n", message);
     exit(FAILURE);
 }
 
@@ -12,14 +12,107 @@ AlgorithmType str_to_algorithm_type (const char *str) {
     dataError("incorrect algorithm type");
 }
 
+DecoderType str_to_decoder_type (const char *str) {
+    for (int j = 0;  j < sizeof (decoderConversion) / sizeof (decoderConversion[0]);  ++j)
+        if (!strcmp (str, decoderConversion[j].str))
+            return decoderConversion[j].val;
+    dataError("incorrect decoder type");
+}
+
+bool is_code_length_limit (int limit) {
+    for (int j = 0;  j < sizeof (codeLengthLimits) / sizeof (codeLengthLimits[0]);  ++j)
+        if (limit == codeLengthLimits[j])
+            return true;
+    return false;
+}
+
+uint8_t to_code_length_limit (int limit) {
+    if (!is_code_length_limit(limit)) {
+        dataError("incorrect max code length");
+    }
+    return limit;
+}
+
+int to_level (int level) {
+    if (level < MIN_LEVEL || level > MAX_LEVEL) {
+        dataError("incorrect level");
+    }
+    return level;
+}
+
+int to_order (int order) {
+    if (order < MIN_ORDER || order > MAX_ORDER) {
+        dataError("incorrect order");
+    }
+    return order;
+}
+
+/*
+ * Converts block size like "65536", "64K" or "4M" to bytes
+ */
+size_t to_block_size (const char *str) {
+    char* end;
+    unsigned long long size = strtoull(str, &end, 10);
+    if (end == str) {
+        dataError("incorrect block size");
+    }
+    if (*end == 'K' || *end == 'k') {
+        size <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        size <<= 20;
+        end++;
+    } else if (*end == 'G' || *end == 'g') {
+        size <<= 30;
+        end++;
+    }
+    if (*end != '\0' || size == 0 || size > MAX_BLOCK_SIZE) {
+        dataError("incorrect block size");
+    }
+    return size;
+}
+
+/*
+ * Converts range like "1048576:4096" (offset:length, in bytes) to numbers
+ */
+void to_range (const char *str, uint64_t* offset, uint64_t* length) {
+    char* end;
+    *offset = strtoull(str, &end, 10);
+    if (end == str || *end != ':') {
+        dataError("incorrect range, expected offset:length");
+    }
+    str = end + 1;
+    *length = strtoull(str, &end, 10);
+    if (end == str || *end != '\0' || *length == 0) {
+        dataError("incorrect range, expected offset:length");
+    }
+}
+
+bool is_std_stream (const char *filename) {
+    return strcmp(filename, STD_STREAM_NAME) == 0;
+}
+
 void initData(Data* data) {
     data->fileIn = "";
     data->fileOut = "";
     data->isArchiving = false;
     data->algorithmType = ALG_HUFFMAN;
+    data->decoderType = DEC_TABLE;
+    data->maxCodeLength = DEFAULT_CODE_LENGTH_LIMIT;
+    data->level = DEFAULT_LEVEL;
+    data->order = DEFAULT_ORDER;
+    data->threads = 1;
+    data->blockSize = 0;
+    data->hasRange = false;
+    data->rangeOffset = 0;
+    data->rangeLength = 0;
+    data->files = NULL;
+    data->filesCount = 0;
+    data->jobs = 1;
 
     data->efficiency = 0;
     data->time = 0;
     data->fileInSize = 0;
     data->fileOutSize = 0;
+    data->lengthLimitLoss = -1;
 }
\ No newline at end of file
@@ -10,7 +10,12 @@
 
 typedef enum {
     ALG_HUFFMAN,
-    ALG_ADAPTIVE_HUFFMAN
+    ALG_ADAPTIVE_HUFFMAN,
+    ALG_LZ,
+    ALG_FAST,
+    ALG_ANS,
+    ALG_RANGE_CODER,
+    ALG_BWT
 } AlgorithmType;
 
 const static struct {
@@ -19,21 +24,82 @@ const static struct {
 } conversion [] = {
     {ALG_HUFFMAN,          "huffman"},
     {ALG_ADAPTIVE_HUFFMAN, "adaptive-huffman"},
+    {ALG_LZ,               "lz"},
+    {ALG_FAST,             "fast"},
+    {ALG_ANS,              "ans"},
+    {ALG_RANGE_CODER,      "range-coder"},
+    {ALG_BWT,              "bwt"},
 };
 
+typedef enum {
+    DEC_TABLE,
+    DEC_TREE
+} DecoderType;
+
+const static struct {
+    DecoderType val;
+    const char  *str;
+} decoderConversion [] = {
+    {DEC_TABLE, "table"},
+    {DEC_TREE,  "tree"},
+};
+
+/* Allowed limits for static Huffman code lengths (in bits) */
+const static uint8_t codeLengthLimits[] = {11, 12, 15, 24};
+#define DEFAULT_CODE_LENGTH_LIMIT 24
+
+/* Compression levels of LZ: higher levels search longer for matches */
+#define MIN_LEVEL 1
+#define MAX_LEVEL 9
+#define DEFAULT_LEVEL 6
+
+/* Context orders of the range coder: bytes are modelled after 0 or 1 previous bytes */
+#define MIN_ORDER 0
+#define MAX_ORDER 1
+#define DEFAULT_ORDER 1
+
+/* Block sizes for block archives (in bytes) */
+#define DEFAULT_BLOCK_SIZE (4 << 20)
+#define MAX_BLOCK_SIZE     (1 << 30)
+
+/* File name for standard input/output */
+#define STD_STREAM_NAME "-"
+
 void dataError(const char* message);
 AlgorithmType str_to_algorithm_type (const char *str);
+DecoderType str_to_decoder_type (const char *str);
+bool is_code_length_limit (int limit);
+uint8_t to_code_length_limit (int limit);
+int to_level (int level);
+int to_order (int order);
+size_t to_block_size (const char *str);
+void to_range (const char *str, uint64_t* offset, uint64_t* length);
+bool is_std_stream (const char *filename);
 
 typedef struct {
     char* fileIn;
     char* fileOut;
     bool isArchiving;
     AlgorithmType algorithmType;
+    DecoderType decoderType; /* How static Huffman codes are decoded */
+    uint8_t maxCodeLength;   /* Limit for static Huffman code lengths (in bits) */
+    int level;               /* LZ compression level (MIN_LEVEL-MAX_LEVEL) */
+    int order;               /* Context order of the range coder (MIN_ORDER-MAX_ORDER) */
+    int threads;             /* Number of threads archiving blocks in parallel */
+    size_t blockSize;        /* Size of independently archived blocks (in bytes), 0 for single-stream archives */
+    bool hasRange;           /* Only a range of the original file is unarchived */
+    uint64_t rangeOffset;
+    uint64_t rangeLength;
+    char** files;            /* Input files and directories of batch mode, NULL for a single file */
+    size_t filesCount;
+    int jobs;                /* Number of files archived in parallel in batch mode */
 
     double efficiency; /* File compression/decompression ratio (in percents, less is better) */
     double time;       /* How much time operation took (in seconds) */
     long fileInSize;   /* Size of input file (in bytes) */
     long fileOutSize;  /* Size of output file (in bytes) */
+    double lengthLimitLoss; /* How much larger archived data is because of maxCodeLength (in percents),
+                             * negative if no code had to be shortened */
 } Data;
 
 void initData(Data* data);
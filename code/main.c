@@ -19,9 +19,17 @@
 #include "data.h"
 #include "parser.h"
 #include "archiver.h"
+#include "batch.h"
 #include "stats.h"
 
-static clock_t startTime; /* Start time in milliseconds */
+/*
+ * Wall clock time in seconds. Processor time would add up the time of all threads
+ */
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
 
 int main(int argc, char const *argv[])
 {
@@ -29,21 +37,26 @@ int main(int argc, char const *argv[])
     initData(&data);
     parse_user_input(argc, (char**) argv, &data);
 
-    startTime = clock();
+    double startTime = now();
 
     int success;
-    if (data.isArchiving)
+    if (data.files != NULL)
+        success = batch(&data);
+    else if (data.isArchiving)
         success = archive(&data);
+    else if (data.hasRange)
+        success = extract(&data);
     else
         success = unarchive(&data);
     if (success != 0) {
-        printf("Unsuccessful operation.\n");
+        fprintf(stderr, "Unsuccessful operation.\n");
         exit(success);
     }
 
-    clock_t duration = clock() - startTime;
-    data.time = (double)duration / CLOCKS_PER_SEC;
+    data.time = now() - startTime;
 
-    output_stats(&data);
+    /* Statistics would mix with data on the standard output */
+    if (!is_std_stream(data.fileOut) && data.fileInSize != FAILURE)
+        output_stats(&data);
     return 0;
 }
\ No newline at end of file
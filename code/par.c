@@ -0,0 +1,185 @@
+#include <stdlib.h>
+
+#include "par.h"
+#include "algorithms/huffman/huffman.h"
+#include "algorithms/lz/lz.h"
+#include "algorithms/fast/fast.h"
+#include "algorithms/ans/ans.h"
+#include "algorithms/bwt/bwt.h"
+
+/* Algorithms which archive independent blocks */
+const static struct {
+    AlgorithmType     type;
+    const BlockCodec* codec;
+} blockCodecs[] = {
+    {ALG_HUFFMAN, &huffmanBlockCodec},
+    {ALG_LZ,      &lzBlockCodec},
+    {ALG_FAST,    &fastBlockCodec},
+    {ALG_ANS,     &ansBlockCodec},
+    {ALG_BWT,     &bwtBlockCodec},
+};
+
+static const BlockCodec* find_codec(AlgorithmType type) {
+    for (size_t i = 0; i < sizeof(blockCodecs) / sizeof(blockCodecs[0]); i++) {
+        if (blockCodecs[i].type == type) {
+            return blockCodecs[i].codec;
+        }
+    }
+    return NULL;
+}
+
+static const BlockCodec* find_codec_by_signature(uint8_t signature) {
+    for (size_t i = 0; i < sizeof(blockCodecs) / sizeof(blockCodecs[0]); i++) {
+        if (blockCodecs[i].codec->signature == signature) {
+            return blockCodecs[i].codec;
+        }
+    }
+    return NULL;
+}
+
+struct ParStream {
+    Data        data;
+    BlockStream blocks;
+};
+
+/*
+ * Codecs take their options from Data
+ */
+static void to_data(const ParContext* ctx, Data* data) {
+    initData(data);
+    data->algorithmType = ctx->algorithmType;
+    data->blockSize = ctx->blockSize;
+    data->threads = ctx->threads > 0 ? ctx->threads : 1;
+    data->maxCodeLength = ctx->maxCodeLength;
+    data->level = ctx->level;
+    data->decoderType = ctx->decoderType;
+}
+
+/*
+ * Returns the codec of the context's algorithm, or NULL if it can't archive
+ * in memory or the options aren't supported. The library can't exit
+ * on bad options like the command line tool, so they're checked here
+ */
+static const BlockCodec* archiving_codec(const ParContext* ctx) {
+    const BlockCodec* codec = find_codec(ctx->algorithmType);
+    if (codec == NULL || ctx->blockSize == 0 || ctx->blockSize > MAX_BLOCK_SIZE ||
+        !is_code_length_limit(ctx->maxCodeLength) || ctx->level < MIN_LEVEL || ctx->level > MAX_LEVEL) {
+        return NULL;
+    }
+    return codec;
+}
+
+/*
+ * Sets default options: Huffman coding of 4M blocks on the calling thread
+ */
+void par_init(ParContext* ctx) {
+    ctx->algorithmType = ALG_HUFFMAN;
+    ctx->blockSize = DEFAULT_BLOCK_SIZE;
+    ctx->threads = 1;
+    ctx->maxCodeLength = DEFAULT_CODE_LENGTH_LIMIT;
+    ctx->level = DEFAULT_LEVEL;
+    ctx->decoderType = DEC_TABLE;
+}
+
+/*
+ * Returns the max archived size of **srcSize** bytes, or 0 if the algorithm
+ * doesn't support in-memory archiving or the options aren't supported
+ */
+size_t par_compress_bound(const ParContext* ctx, size_t srcSize) {
+    const BlockCodec* codec = archiving_codec(ctx);
+    if (codec == NULL) {
+        return 0;
+    }
+    return blocks_bound(codec, srcSize, ctx->blockSize);
+}
+
+/*
+ * Archives **srcSize** bytes of src into dst. Returns the archived size, or FAILURE
+ * if the options aren't supported or it doesn't fit into **dstCapacity** bytes
+ * (see par_compress_bound())
+ */
+long par_compress(ParContext* ctx, const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity) {
+    const BlockCodec* codec = archiving_codec(ctx);
+    if (codec == NULL) {
+        return FAILURE;
+    }
+    Data data;
+    to_data(ctx, &data);
+    return blocks_compress_memory(codec, &data, src, srcSize, dst, dstCapacity);
+}
+
+/*
+ * Returns the unarchived size of an archive, or FAILURE if it's broken
+ */
+long par_decompressed_size(const uint8_t* src, size_t srcSize) {
+    return blocks_decompressed_size(src, srcSize);
+}
+
+/*
+ * Unarchives **srcSize** bytes of src into dst. The algorithm is found from
+ * the archive. Returns the unarchived size, or FAILURE if the archive is broken
+ * or doesn't fit into **dstCapacity** bytes (see par_decompressed_size())
+ */
+long par_decompress(ParContext* ctx, const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity) {
+    if (srcSize < 2) {
+        return FAILURE;
+    }
+    const BlockCodec* codec = find_codec_by_signature(src[1]);
+    if (codec == NULL) {
+        return FAILURE;
+    }
+    Data data;
+    to_data(ctx, &data);
+    return blocks_decompress_memory(codec, &data, src, srcSize, dst, dstCapacity);
+}
+
+/*
+ * Starts archiving a stream. Returns NULL if the options aren't supported
+ */
+ParStream* par_stream_init(const ParContext* ctx) {
+    const BlockCodec* codec = archiving_codec(ctx);
+    if (codec == NULL) {
+        return NULL;
+    }
+    ParStream* stream = malloc(sizeof(ParStream));
+    to_data(ctx, &stream->data);
+    blocks_stream_init_archiving(&stream->blocks, codec, &stream->data);
+    return stream;
+}
+
+/*
+ * Archives as much of in as fits into out. Whole blocks are archived as soon as
+ * they're collected. STREAM_FLUSH archives the rest of the input too, so everything
+ * given so far can be unarchived (e.g. at the end of a message); STREAM_FINISH
+ * also ends the archive. Returns the number of archived bytes waiting for output
+ * space, or FAILURE. After a flush, call again with more space until it's 0
+ */
+long par_stream_compress(ParStream* stream, StreamInput* in, StreamOutput* out, StreamFlush flush) {
+    return blocks_stream_archive(&stream->blocks, in, out, flush);
+}
+
+/*
+ * Starts unarchiving a stream, the algorithm is found from the archive
+ */
+ParStream* par_stream_decompress_init(const ParContext* ctx) {
+    ParStream* stream = malloc(sizeof(ParStream));
+    to_data(ctx, &stream->data);
+    blocks_stream_init_unarchiving(&stream->blocks, find_codec_by_signature, &stream->data);
+    return stream;
+}
+
+/*
+ * Unarchives as much of in as fits into out. Returns 0 once the whole archive
+ * is unarchived, a positive number while more input or output space is needed,
+ * or FAILURE if the archive is broken
+ */
+long par_stream_decompress(ParStream* stream, StreamInput* in, StreamOutput* out) {
+    return blocks_stream_unarchive(&stream->blocks, in, out);
+}
+
+void par_stream_end(ParStream* stream) {
+    if (stream != NULL) {
+        blocks_stream_free(&stream->blocks);
+        free(stream);
+    }
+}
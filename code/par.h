@@ -0,0 +1,43 @@
+#ifndef PAR_H
+#define PAR_H
+
+#include "common.h"
+#include "data.h"
+#include "blocks.h"
+
+/*
+ * In-memory archiving. Archives have the same format as block archives
+ * made by ./archive, so either side can unarchive the other's output.
+ *
+ * Nothing here touches the global state of the command line tool, so
+ * any number of threads can archive at once, each with its own context
+ */
+typedef struct {
+    AlgorithmType algorithmType;
+    size_t        blockSize;     /* Size of independently archived blocks (in bytes) */
+    int           threads;       /* Number of threads archiving blocks of one buffer */
+    uint8_t       maxCodeLength; /* Limit for static Huffman code lengths (in bits) */
+    int           level;         /* LZ compression level (MIN_LEVEL-MAX_LEVEL) */
+    DecoderType   decoderType;
+} ParContext;
+
+void par_init(ParContext* ctx);
+size_t par_compress_bound(const ParContext* ctx, size_t srcSize);
+long par_compress(ParContext* ctx, const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity);
+long par_decompressed_size(const uint8_t* src, size_t srcSize);
+long par_decompress(ParContext* ctx, const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity);
+
+/*
+ * Incremental archiving, for data which is produced (or consumed) piece by piece.
+ * Each call moves data from in->data + in->position to out->data + out->position
+ * and advances both positions. Only about two blocks are held in memory
+ */
+typedef struct ParStream ParStream;
+
+ParStream* par_stream_init(const ParContext* ctx);
+long par_stream_compress(ParStream* stream, StreamInput* in, StreamOutput* out, StreamFlush flush);
+ParStream* par_stream_decompress_init(const ParContext* ctx);
+long par_stream_decompress(ParStream* stream, StreamInput* in, StreamOutput* out);
+void par_stream_end(ParStream* stream);
+
+#endif
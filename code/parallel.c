@@ -0,0 +1,196 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "parallel.h"
+
+typedef struct {
+    ParallelTask    task;
+    void*           context;
+    size_t          count;
+    size_t          next;  /* Index of the next task to be taken */
+    pthread_mutex_t lock;
+} TaskQueue;
+
+static void* worker(void* arg) {
+    TaskQueue* queue = arg;
+    while (true) {
+        pthread_mutex_lock(&queue->lock);
+        size_t index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (index >= queue->count) {
+            return NULL;
+        }
+        queue->task(queue->context, index);
+    }
+}
+
+/*
+ * Runs task(context, i) for every i in [0, count) on up to **threads** threads
+ * and waits until all of them are done. Tasks are taken in index order.
+ * With one thread (or one task), everything runs on the calling thread
+ */
+void parallel_for(size_t count, int threads, ParallelTask task, void* context) {
+    if (threads > count) {
+        threads = count;
+    }
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            task(context, i);
+        }
+        return;
+    }
+
+    TaskQueue queue = {task, context, count, 0};
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_t* workers = malloc(threads * sizeof(pthread_t));
+
+    /* The calling thread is one of the workers */
+    for (int i = 0; i < threads - 1; i++) {
+        pthread_create(&workers[i], NULL, worker, &queue);
+    }
+    worker(&queue);
+    for (int i = 0; i < threads - 1; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+    pthread_mutex_destroy(&queue.lock);
+}
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_READ,    /* Filled by the reader, waiting for a coder */
+    SLOT_CODING,
+    SLOT_CODED    /* Waiting for the writer */
+} SlotState;
+
+typedef struct {
+    const PipelineStages* stages;
+    void*                 context;
+    void**                slots;
+    SlotState*            states;
+    size_t                slotsCount;
+    size_t                readCount;    /* Number of slots filled by the reader */
+    size_t                codeCount;    /* Number of slots taken by coders */
+    size_t                writeCount;   /* Number of slots written */
+    bool                  end;          /* The reader has reached the end of input */
+    bool                  stop;         /* The writer has failed */
+    pthread_mutex_t       lock;
+    pthread_cond_t        changed;
+} Pipeline;
+
+static void* reader(void* arg) {
+    Pipeline* pipeline = arg;
+    while (true) {
+        pthread_mutex_lock(&pipeline->lock);
+        while (pipeline->readCount - pipeline->writeCount == pipeline->slotsCount && !pipeline->stop) {
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        }
+        if (pipeline->stop) {
+            pthread_mutex_unlock(&pipeline->lock);
+            return NULL;
+        }
+        size_t index = pipeline->readCount % pipeline->slotsCount;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        /* The slot is free, only the reader touches it */
+        bool filled = pipeline->stages->read(pipeline->context, pipeline->slots[index]);
+
+        pthread_mutex_lock(&pipeline->lock);
+        if (filled) {
+            pipeline->states[index] = SLOT_READ;
+            pipeline->readCount++;
+        } else {
+            pipeline->end = true;
+        }
+        pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->lock);
+        if (!filled) {
+            return NULL;
+        }
+    }
+}
+
+static void* coder(void* arg) {
+    Pipeline* pipeline = arg;
+    pthread_mutex_lock(&pipeline->lock);
+    while (true) {
+        while (pipeline->codeCount == pipeline->readCount && !pipeline->end && !pipeline->stop) {
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        }
+        if (pipeline->codeCount == pipeline->readCount || pipeline->stop) {
+            break;
+        }
+        size_t index = pipeline->codeCount++ % pipeline->slotsCount;
+        pipeline->states[index] = SLOT_CODING;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        pipeline->stages->code(pipeline->context, pipeline->slots[index]);
+
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->states[index] = SLOT_CODED;
+        pthread_cond_broadcast(&pipeline->changed);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+/*
+ * Runs a three-stage pipeline over a ring of **slotsCount** slots: a reader thread
+ * fills free slots, **threads** coder threads process filled ones, and the calling
+ * thread writes processed slots in the order they were read. So reading, coding
+ * and writing overlap. Stops at the end of input, or when writing a slot fails
+ */
+void run_pipeline(const PipelineStages* stages, void* context, void** slots, size_t slotsCount, int threads) {
+    Pipeline pipeline = {stages, context, slots, malloc(slotsCount * sizeof(SlotState)), slotsCount, 0, 0, 0,
+                         false, false};
+    for (size_t i = 0; i < slotsCount; i++) {
+        pipeline.states[i] = SLOT_FREE;
+    }
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.changed, NULL);
+
+    pthread_t readerThread;
+    pthread_t* coderThreads = malloc(threads * sizeof(pthread_t));
+    pthread_create(&readerThread, NULL, reader, &pipeline);
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&coderThreads[i], NULL, coder, &pipeline);
+    }
+
+    pthread_mutex_lock(&pipeline.lock);
+    while (true) {
+        size_t index = pipeline.writeCount % slotsCount;
+        while (!(pipeline.writeCount < pipeline.readCount && pipeline.states[index] == SLOT_CODED) &&
+               !(pipeline.end && pipeline.writeCount == pipeline.readCount)) {
+            pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+        }
+        if (pipeline.writeCount == pipeline.readCount) { /* Everything is written */
+            break;
+        }
+        pthread_mutex_unlock(&pipeline.lock);
+
+        bool written = stages->write(context, slots[index]);
+
+        pthread_mutex_lock(&pipeline.lock);
+        pipeline.states[index] = SLOT_FREE;
+        pipeline.writeCount++;
+        if (!written) {
+            pipeline.stop = true;
+        }
+        pthread_cond_broadcast(&pipeline.changed);
+        if (!written) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pipeline.lock);
+
+    pthread_join(readerThread, NULL);
+    for (int i = 0; i < threads; i++) {
+        pthread_join(coderThreads[i], NULL);
+    }
+    free(coderThreads);
+    free(pipeline.states);
+    pthread_cond_destroy(&pipeline.changed);
+    pthread_mutex_destroy(&pipeline.lock);
+}
@@ -0,0 +1,21 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "common.h"
+
+typedef void (*ParallelTask)(void* context, size_t index);
+
+void parallel_for(size_t count, int threads, ParallelTask task, void* context);
+
+/*
+ * Stages of run_pipeline(). Each stage gets the pipeline context and a slot
+ */
+typedef struct {
+    bool (*read)(void* context, void* slot);  /* Fills the slot, returns false at the end of input */
+    void (*code)(void* context, void* slot);  /* Called concurrently for different slots */
+    bool (*write)(void* context, void* slot); /* Called in input order, returns false to stop */
+} PipelineStages;
+
+void run_pipeline(const PipelineStages* stages, void* context, void** slots, size_t slotsCount, int threads);
+
+#endif
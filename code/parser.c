@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include "parser.h"
 #include "utils/argparse.h"
@@ -14,7 +15,7 @@ static const char *const usages[] = {
 };
 
 static void error(const char* message) {
-    printf("Error: %s.\n", message);
+    fprintf(stderr, "Error: %s.\n", message);
     exit(FAILURE);
 }
 
@@ -63,7 +64,7 @@ static char* replace_suffix(const char *str, const char *suffix) {
  * Determines output filename and returns it,
  * based on the input file name and whether it's being archived or unarchived
  */
-static char* determine_out_file(Data* data) {
+char* determine_out_file(Data* data) {
     if (data->isArchiving == true) {
         return add_suffix(data->fileIn, ".par");
     }
@@ -72,6 +73,11 @@ static char* determine_out_file(Data* data) {
     }
     return add_suffix(data->fileIn, ".uar");
 }
+static bool is_directory(const char* path) {
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
 /*
  * Determines whether the input file is to be archived or unarchived,
  * based on the input file name,
@@ -95,21 +101,37 @@ static bool determine_is_archiving(int argc, char *argv[]) {
 }
 
 void parse_user_input(int argc, char *argv[], Data* data) {
-    bool isArchiving = 0;
-    bool isUnarchiving = 0;
+    int isArchiving = 0;
+    int isUnarchiving = 0;
     char* algorithm = NULL;
+    char* decoder = NULL;
+    int maxCodeLength = 0;
+    int level = 0;
+    int order = -1;
+    int threads = 0;
+    char* blockSize = NULL;
+    char* range = NULL;
+    int jobs = 0;
     struct argparse_option options[] = {
         OPT_HELP(),
         OPT_GROUP("Basic options"),
         OPT_BOOLEAN('a', NULL, &isArchiving, "archive", NULL, 0, 0),
         OPT_BOOLEAN('u', NULL, &isUnarchiving, "unarchive", NULL, 0, 0),
         OPT_STRING(0, "algorithm", &algorithm, "algorithm type", NULL, 0, 0),
+        OPT_STRING(0, "decoder", &decoder, "huffman decoder type", NULL, 0, 0),
+        OPT_INTEGER(0, "max-code-length", &maxCodeLength, "huffman code length limit: 11, 12, 15 or 24 (*)", NULL, 0, 0),
+        OPT_INTEGER(0, "level", &level, "lz compression level: 1 (fastest) to 9 (smallest), 6 (*)", NULL, 0, 0),
+        OPT_INTEGER(0, "order", &order, "range-coder context order: 0 or 1 (*)", NULL, 0, 0),
+        OPT_INTEGER(0, "threads", &threads, "number of threads archiving blocks in parallel", NULL, 0, 0),
+        OPT_STRING(0, "block-size", &blockSize, "archive independent blocks of this size, e.g. 64K or 4M", NULL, 0, 0),
+        OPT_STRING(0, "range", &range, "unarchive only bytes offset:length of a block archive", NULL, 0, 0),
+        OPT_INTEGER(0, "jobs", &jobs, "number of files archived in parallel, with several input files", NULL, 0, 0),
         OPT_END(),
     };
     struct argparse argparse;
     argparse_init(&argparse, options, usages, 0);
     argparse_describe(&argparse, "\npar - pocket archiver. A simple data compression cli program, which supports a set of compression algorithms.", 
-                                 "\nAlgorithm types\n    huffman (*)\n    adaptive-huffman\n\nArgs: [[--] [input file] [output file]]\n  or: [[--] [input file]]\nEmpty args sets input file name to default.");
+                                 "\nAlgorithm types\n    huffman (*)\n    adaptive-huffman\n    lz\n    fast\n    ans\n    range-coder\n    bwt\n\nDecoder types\n    table (*)\n    tree\n\nArgs: [[--] [input file] [output file]]\n  or: [[--] [input file]]\n  or: [[--] [input files and directories...]]\nEmpty args sets input file name to default. Output file \"-\" is the standard output.");
     argc = argparse_parse(&argparse, argc, (const char**) argv);
 
     /* Both -u and -a are specified */
@@ -129,12 +151,73 @@ void parse_user_input(int argc, char *argv[], Data* data) {
         data->algorithmType = str_to_algorithm_type(algorithm);
     }
 
+    if (decoder != NULL) {
+        data->decoderType = str_to_decoder_type(decoder);
+    }
+
+    if (maxCodeLength != 0) {
+        data->maxCodeLength = to_code_length_limit(maxCodeLength);
+    }
+
+    if (level != 0) {
+        data->level = to_level(level);
+    }
+
+    if (order != -1) {
+        data->order = to_order(order);
+    }
+
+    if (threads < 0) {
+        error("incorrect number of threads");
+    } else if (threads != 0) {
+        data->threads = threads;
+    }
+
+    if (blockSize != NULL) {
+        data->blockSize = to_block_size(blockSize);
+    } else if (data->threads > 1) {
+        data->blockSize = DEFAULT_BLOCK_SIZE;
+    }
+
+    if (range != NULL) {
+        if (data->isArchiving) {
+            error("range can only be unarchived");
+        }
+        data->hasRange = true;
+        to_range(range, &data->rangeOffset, &data->rangeLength);
+    }
+
+    if (jobs < 0) {
+        error("incorrect number of jobs");
+    } else if (jobs != 0) {
+        data->jobs = jobs;
+    }
+
+    /* Several files or a directory: every file gets its own archive */
+    if (jobs != 0 || argc > 2 || (argc > 0 && is_directory(argv[0]))) {
+        if (argc == 0) {
+            error("no input files");
+        }
+        if (data->hasRange) {
+            error("range can't be unarchived from several files");
+        }
+        for (int i = 0; i < argc; i++) {
+            if (is_std_stream(argv[i])) {
+                error("the standard input can't be one of several files");
+            }
+        }
+        data->files = argv;
+        data->filesCount = argc;
+        return;
+    }
+
     if (argc == 0) {
         data->fileIn = DEFAULT_FILEIN;
         data->fileOut = determine_out_file(data);
     } else if (argc == 1) {
         data->fileIn = argv[0];
-        data->fileOut = determine_out_file(data);
+        /* A range goes to the standard output, unless the output file is given */
+        data->fileOut = data->hasRange ? STD_STREAM_NAME : determine_out_file(data);
     } else {
         data->fileIn = argv[0];
         data->fileOut = argv[1];
@@ -5,5 +5,6 @@
 #include "data.h"
 
 void parse_user_input(int argc, char *argv[], Data* data);
+char* determine_out_file(Data* data);
 
 #endif
\ No newline at end of file
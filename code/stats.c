@@ -43,5 +43,24 @@ void output_stats(Data* data) {
     
     printf("Compression ratio: %.2f%% (less percents - higher compression, 100%% - no compression)\n\n",
             data->efficiency);
+    if (data->lengthLimitLoss >= 0) {
+        printf("Code lengths limited to %d bits: archived data is %.4f%% larger than with unlimited codes\n\n",
+                data->maxCodeLength, data->lengthLimitLoss);
+    }
     printf("Operation took: %.4f seconds\n", data->time);
+}
+
+/*
+ * Outputs a line with the sizes of one file of a batch
+ */
+void output_file_stats(Data* data, int status) {
+    if (status != 0) {
+        printf("%s: failed\n", data->fileIn);
+        return;
+    }
+    char* inSize = format_file_size(data->fileInSize);
+    char* outSize = format_file_size(data->fileOutSize);
+    printf("%s -> %s: %s -> %s (%.2f%%)\n", data->fileIn, data->fileOut, inSize, outSize, data->efficiency);
+    free(inSize);
+    free(outSize);
 }
\ No newline at end of file
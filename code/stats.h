@@ -5,5 +5,6 @@
 #include "data.h"
 
 void output_stats(Data* data);
+void output_file_stats(Data* data, int status);
 
 #endif
\ No newline at end of file
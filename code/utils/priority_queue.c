@@ -64,7 +64,7 @@ priority_queue *create_priority_queue( const int capacity, int ( *comparator )(
 
         if ( capacity < MIN_PRIORITY_QUEUE_CAPACITY )
         {
-                printf( "\nBad priority queue parameters. Minimum priority queue capacity is %d.\n", MIN_PRIORITY_QUEUE_CAPACITY );
+                fprintf( stderr, "\nBad priority queue parameters. Minimum priority queue capacity is %d.\n", MIN_PRIORITY_QUEUE_CAPACITY );
                 return NULL;
         }
         else
@@ -73,7 +73,7 @@ priority_queue *create_priority_queue( const int capacity, int ( *comparator )(
 
                 if ( pq == NULL )
                 {
-                        printf( "\nPriority queue memory allocation failed.\n" );
+                        fprintf( stderr, "\nPriority queue memory allocation failed.\n" );
                         return NULL;
                 }
                 
@@ -86,7 +86,7 @@ priority_queue *create_priority_queue( const int capacity, int ( *comparator )(
 
                 if ( pq->heap_array == NULL )
                 {
-                        printf( "Priority queue heap memory allocation failed.\n" );
+                        fprintf( stderr, "Priority queue heap memory allocation failed.\n" );
                         free( pq );
                         return NULL;
                 }
@@ -191,12 +191,12 @@ int priority_queue_insert( priority_queue *pq, void *item )
 {
         if ( pq == NULL )
         {
-                printf( "Priority queue is uninitialized.\n" );
+                fprintf( stderr, "Priority queue is uninitialized.\n" );
                 return FALSE;
         }
         else if ( item == NULL )
         {
-                printf( "Item pointer is NULL.\n" );
+                fprintf( stderr, "Item pointer is NULL.\n" );
                 return FALSE;
         }
         else
@@ -204,7 +204,7 @@ int priority_queue_insert( priority_queue *pq, void *item )
                 /* 2 = 1 for spare item in array + 1 for next item */
                 if( ensure_capacity( pq, pq->heap_size + 2 ) == FALSE )
                 {
-                        printf( "\nPriority queue out of memory.\n" );
+                        fprintf( stderr, "\nPriority queue out of memory.\n" );
                         return FALSE;
                 }
 
@@ -238,7 +238,7 @@ void *priority_queue_poll( priority_queue *pq )
 {
         if ( pq == NULL )
         {
-                printf( "Priority queue is uninitialized.\n" );
+                fprintf( stderr, "Priority queue is uninitialized.\n" );
                 return NULL;
         }
         else
@@ -265,7 +265,7 @@ int priority_queue_is_empty( const priority_queue *pq )
 {
         if ( pq == NULL )
         {
-                printf( "Priority queue is uninitialized.\n" );
+                fprintf( stderr, "Priority queue is uninitialized.\n" );
                 return ERROR_VALUE;
         }
         else
@@ -289,7 +289,7 @@ int priority_queue_size( const priority_queue *pq )
 {
         if ( pq == NULL )
         {
-                printf( "Priority queue is uninitialized.\n" );
+                fprintf( stderr, "Priority queue is uninitialized.\n" );
                 return ERROR_VALUE;
         }
         else
@@ -309,7 +309,7 @@ int priority_queue_trim_to_size( priority_queue *pq )
 
         if( pq == NULL )
         {
-                printf( "Priority queue is uninitialized.\n" );
+                fprintf( stderr, "Priority queue is uninitialized.\n" );
                 return FALSE;
         }
         else
@@ -353,17 +353,13 @@ void free_priority_queue( priority_queue **pq )
 {
         if ( *pq == NULL )
         {
-                printf( "Priority queue is uninitialized.\n" );
+                fprintf( stderr, "Priority queue is uninitialized.\n" );
         }
         else
         {
-                printf( "Frees priority queue memory..." );
-
                 free( (*pq)->heap_array );
                 free( (*pq) );
                 (*pq) = NULL;
-
-                printf( "OK\n" );
         }
 }
 
@@ -377,7 +373,7 @@ void print_priority_queue( const priority_queue *pq, char* (*to_string)( void *
 
         if ( pq == NULL )
         {
-                printf( "Priority queue is uninitialized.\n" );
+                fprintf( stderr, "Priority queue is uninitialized.\n" );
         }
         else
         {
@@ -0,0 +1,132 @@
+#!/bin/sh
+# Runs the command line tests: sh tests/run.sh [path to archive]
+ARCHIVE=${1:-./archive}
+INPUT=examples/example.png
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+failures=0
+
+fail() {
+    echo "FAIL: $1"
+    failures=$((failures + 1))
+}
+
+pass() {
+    echo "ok: $1"
+}
+
+# Overwrites bytes of a file at an offset, with a printf format of the bytes
+patch_bytes() {
+    printf "$3" | dd of="$1" bs=1 seek="$2" conv=notrunc 2>/dev/null
+}
+
+# A truncated single-stream Huffman archive must fail instead of giving garbage
+test_huffman_truncated() {
+    "$ARCHIVE" -a "$INPUT" "$TMP/full.par" >/dev/null || { fail "huffman truncated: archiving"; return; }
+    head -c 20000 "$TMP/full.par" > "$TMP/truncated.par"
+    if "$ARCHIVE" -u "$TMP/truncated.par" "$TMP/truncated.out" >/dev/null 2>&1; then
+        fail "huffman truncated: unarchived successfully"
+    elif "$ARCHIVE" -u - "$TMP/piped.out" < "$TMP/truncated.par" >/dev/null 2>&1; then
+        fail "huffman truncated: unarchived successfully from a pipe"
+    else
+        pass "huffman truncated"
+    fi
+}
+
+# An original size of 1T in the heading must not make unarchiving write past the archived data
+test_huffman_corrupt_size() {
+    "$ARCHIVE" -a "$INPUT" "$TMP/size.par" >/dev/null || { fail "huffman corrupt size: archiving"; return; }
+    patch_bytes "$TMP/size.par" 4 '\000\000\000\000\000\001\000\000'
+    limit=$(($(wc -c < "$INPUT") + 65536))
+    if timeout 20 "$ARCHIVE" -u "$TMP/size.par" "$TMP/size.out" >/dev/null 2>&1; then
+        fail "huffman corrupt size: unarchived successfully"
+    elif [ "$(wc -c < "$TMP/size.out")" -gt "$limit" ]; then
+        fail "huffman corrupt size: wrote $(wc -c < "$TMP/size.out") bytes"
+    elif timeout 20 "$ARCHIVE" -u - "$TMP/size-piped.out" < "$TMP/size.par" >/dev/null 2>&1; then
+        fail "huffman corrupt size: unarchived successfully from a pipe"
+    else
+        pass "huffman corrupt size"
+    fi
+}
+
+# A heading with a too long max code length must be rejected before the code lengths are read
+test_huffman_corrupt_max_length() {
+    "$ARCHIVE" -a "$INPUT" "$TMP/length.par" >/dev/null || { fail "huffman corrupt max length: archiving"; return; }
+    patch_bytes "$TMP/length.par" 3 '\377'
+    "$ARCHIVE" -u "$TMP/length.par" "$TMP/length.out" >/dev/null 2>&1
+    status=$?
+    if [ $status -ne 255 ]; then
+        fail "huffman corrupt max length: exit status $status"
+    else
+        pass "huffman corrupt max length"
+    fi
+}
+
+# Errors go to stderr, so they don't end up in data written to the standard output
+test_errors_on_stderr() {
+    printf 'not an archive' > "$TMP/bad.par"
+    if "$ARCHIVE" -u - - < "$TMP/bad.par" > "$TMP/stdout.out" 2>/dev/null; then
+        fail "errors on stderr: unarchived successfully"
+    elif [ -s "$TMP/stdout.out" ]; then
+        fail "errors on stderr: the standard output has: $(head -c 100 "$TMP/stdout.out")"
+    else
+        pass "errors on stderr"
+    fi
+}
+
+# A failing --range goes to the standard output by default: it must have no error text
+test_extract_errors_on_stderr() {
+    "$ARCHIVE" -a --block-size=16K "$INPUT" "$TMP/blocks.par" >/dev/null || { fail "extract errors: archiving"; return; }
+    if "$ARCHIVE" -u --range=100000000:10 "$TMP/blocks.par" > "$TMP/range.out" 2>/dev/null; then
+        fail "extract errors: a range past the end was unarchived"
+    elif [ -s "$TMP/range.out" ]; then
+        fail "extract errors: the standard output has: $(head -c 100 "$TMP/range.out")"
+    else
+        pass "extract errors: range past the end"
+    fi
+
+    # Breaks the archived size of the first block in the index
+    size=$(wc -c < "$TMP/blocks.par")
+    count=$(od -An -tu8 -j $((size - 8)) -N8 "$TMP/blocks.par" | tr -d ' ')
+    patch_bytes "$TMP/blocks.par" $((size - 8 - 16 * count + 8)) '\377\377\377\377'
+    if "$ARCHIVE" -u --range=0:100 "$TMP/blocks.par" > "$TMP/index.out" 2>/dev/null; then
+        fail "extract errors: an archive with a broken index was unarchived"
+    elif grep -q "rror\|Unsuccessful" "$TMP/index.out"; then
+        fail "extract errors: the standard output has error text"
+    else
+        pass "extract errors: broken index"
+    fi
+}
+
+# Writing to a full disk must fail, archiving and unarchiving blocks
+test_write_errors() {
+    if [ ! -w /dev/full ]; then
+        pass "write errors: skipped, no /dev/full"
+        return
+    fi
+    if "$ARCHIVE" -a --block-size=16K "$INPUT" /dev/full >/dev/null 2>&1; then
+        fail "write errors: archived to a full disk"
+        return
+    fi
+    "$ARCHIVE" -a --block-size=16K "$INPUT" "$TMP/write.par" >/dev/null || { fail "write errors: archiving"; return; }
+    if "$ARCHIVE" -u "$TMP/write.par" /dev/full >/dev/null 2>&1; then
+        fail "write errors: unarchived to a full disk"
+    elif "$ARCHIVE" -u --range=0:100 "$TMP/write.par" /dev/full >/dev/null 2>&1; then
+        fail "write errors: extracted to a full disk"
+    else
+        pass "write errors"
+    fi
+}
+
+test_huffman_truncated
+test_huffman_corrupt_size
+test_huffman_corrupt_max_length
+test_errors_on_stderr
+test_extract_errors_on_stderr
+test_write_errors
+
+if [ $failures -ne 0 ]; then
+    echo "$failures failed"
+    exit 1
+fi
+echo "all passed"